@@ -0,0 +1,83 @@
+#ifndef BBOTK_H
+#define BBOTK_H
+
+// Public C API of bbotk.
+// Use it from another package with `LinkingTo: bbotk` and `#include <bbotk.h>`.
+
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Rdynload.h>
+#include <stdint.h>
+
+// Compact, typed storage for a block of configurations, as used by the local search engine.
+// Columns are stored per parameter (in search space order), with a type depending on the param class:
+//   ParamDbl: dbl[j], double values
+//   ParamInt: ints[j], int values
+//   ParamFct: ints[j], 0-based level index into the levels of the param
+//   ParamLgl: lgl[j], packed bits, one bit per row
+// For all params, na[j] is a bitmask with one bit per row, set if the param is NA (inactive).
+// The value slot of an NA element is always zero.
+typedef struct bbotk_configs {
+  int n_rows;
+  int n_params;
+  int n_words;      // number of 64-bit words per bitmask column
+  double **dbl;     // NULL for all non-ParamDbl columns
+  int **ints;       // NULL for all non-ParamInt / non-ParamFct columns
+  uint64_t **lgl;   // NULL for all non-ParamLgl columns
+  uint64_t **na;
+} bbotk_configs;
+
+// get a single bit of a packed bitmask column (lgl or na)
+static inline int bbotk_bit_get(const uint64_t *bits, int i) {
+  return (int) ((bits[i >> 6] >> (i & 63)) & 1);
+}
+
+// Native objective for local_search().
+// Must write x->n_rows objective values to y, in the original scale (local_search handles maximization).
+// Return 0 on success, any other value stops the search, like a terminator.
+// `data` is passed through unchanged.
+typedef int (*bbotk_objective_fn)(const bbotk_configs *x, double *y, void *data);
+
+typedef struct {
+  bbotk_objective_fn fn;
+  void *data;
+} bbotk_native_objective;
+
+// Wrap a native objective in an external pointer, which can be passed as `objective` to local_search().
+// The returned SEXP must be protected by the caller.
+static inline SEXP bbotk_native_objective_create(bbotk_objective_fn fn, void *data) {
+  // we store the struct in a raw vector, so it is owned by the external pointer and needs no finalizer
+  SEXP s_raw = PROTECT(Rf_allocVector(RAWSXP, sizeof(bbotk_native_objective)));
+  bbotk_native_objective *obj = (bbotk_native_objective*) RAW(s_raw);
+  obj->fn = fn;
+  obj->data = data;
+  SEXP s_ptr = PROTECT(R_MakeExternalPtr(obj, Rf_install("bbotk_native_objective"), s_raw));
+  Rf_setAttrib(s_ptr, R_ClassSymbol, Rf_mkString("bbotk_native_objective"));
+  UNPROTECT(2); // s_raw, s_ptr
+  return s_ptr;
+}
+
+// Run the local search from C, same arguments as the internal `.Call("c_local_search", ...)` in local_search():
+// objective (R function or native objective), paradox ParamSet or compiled search space (see below),
+// local_search_control(), initial points data.table or the 'state' element of a previous result to resume from.
+// Returns list(x, y, state, top).
+static inline SEXP bbotk_local_search(SEXP s_obj, SEXP s_ss, SEXP s_ctrl, SEXP s_initial_x) {
+  static SEXP (*fun)(SEXP, SEXP, SEXP, SEXP) = NULL;
+  if (fun == NULL) {
+    fun = (SEXP (*)(SEXP, SEXP, SEXP, SEXP)) R_GetCCallable("bbotk", "c_local_search");
+  }
+  return fun(s_obj, s_ss, s_ctrl, s_initial_x);
+}
+
+// Compile a paradox ParamSet once, the result can be passed to bbotk_local_search() instead of the ParamSet,
+// so repeated searches on the same search space skip all setup work.
+// The returned SEXP must be protected by the caller.
+static inline SEXP bbotk_local_search_compile(SEXP s_ss) {
+  static SEXP (*fun)(SEXP) = NULL;
+  if (fun == NULL) {
+    fun = (SEXP (*)(SEXP)) R_GetCCallable("bbotk", "c_local_search_compile");
+  }
+  return fun(s_ss);
+}
+
+#endif // BBOTK_H
@@ -0,0 +1,379 @@
+#include "cmaes.h"
+
+#include <Rmath.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+// CMA-ES with rank-one and rank-mu update and cumulative step-size adaptation,
+// following the purecmaes reference implementation of Hansen (2016).
+// vectors of dimension n are stored like the columns of an R matrix: coordinate i of candidate k is x[k * n + i]
+
+typedef struct {
+    int n, lambda, mu;
+    double sigma, mueff, cc, cs, c1, cmu, damps, chiN;
+    double tol_x, tol_fun;
+    int n_gen, counteval, eigeneval, n_sampled;
+    int hist_cap, hist_len;
+    double *weights, *xmean, *xold, *pc, *ps, *C, *B, *D, *arz, *ary, *arx, *fitness, *hist, *tmp;
+    int *idx, *idx_tmp;
+} Cmaes;
+
+enum {
+    CMAES_CONTINUE = 0,
+    CMAES_TOL_X = 1,
+    CMAES_TOL_FUN = 2,
+    CMAES_CONDITION = 3,
+    CMAES_NO_EFFECT_AXIS = 4,
+    CMAES_NO_EFFECT_COORD = 5
+};
+
+static void cmaes_free(Cmaes *es) {
+    free(es->weights);
+    free(es->idx);
+    free(es);
+}
+
+static void cmaes_finalizer(SEXP s_ptr) {
+    Cmaes *es = (Cmaes*) R_ExternalPtrAddr(s_ptr);
+    if (es == NULL) return;
+    cmaes_free(es);
+    R_ClearExternalPtr(s_ptr);
+}
+
+static Cmaes *get_cmaes(SEXP s_ptr) {
+    if (TYPEOF(s_ptr) != EXTPTRSXP) error("Expected an external pointer to a CMA-ES state");
+    Cmaes *es = (Cmaes*) R_ExternalPtrAddr(s_ptr);
+    if (es == NULL) error("CMA-ES state is not valid anymore");
+    return es;
+}
+
+/***** Linear algebra *****/
+
+// eigen decomposition of the symmetric matrix a with the cyclic Jacobi method.
+// a is overwritten, the eigenvectors are the columns of v and the eigenvalues are stored in d.
+static void eigen_sym(int n, double *a, double *v, double *d) {
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) v[j * n + i] = i == j ? 1.0 : 0.0;
+    }
+    for (int sweep = 0; sweep < 50; sweep++) {
+        double off = 0.0, diag = 0.0;
+        for (int q = 0; q < n; q++) {
+            diag += a[q * n + q] * a[q * n + q];
+            for (int p = 0; p < q; p++) off += a[q * n + p] * a[q * n + p];
+        }
+        if (off <= DBL_EPSILON * DBL_EPSILON * diag) break;
+        for (int p = 0; p < n - 1; p++) {
+            for (int q = p + 1; q < n; q++) {
+                double apq = a[q * n + p];
+                if (apq == 0.0) continue;
+                // rotation that sets a[p, q] to zero
+                double theta = (a[q * n + q] - a[p * n + p]) / (2.0 * apq);
+                double t = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                double c = 1.0 / sqrt(t * t + 1.0), s = t * c;
+                for (int k = 0; k < n; k++) {
+                    double akp = a[p * n + k], akq = a[q * n + k];
+                    a[p * n + k] = c * akp - s * akq;
+                    a[q * n + k] = s * akp + c * akq;
+                }
+                for (int k = 0; k < n; k++) {
+                    double apk = a[k * n + p], aqk = a[k * n + q];
+                    a[k * n + p] = c * apk - s * aqk;
+                    a[k * n + q] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < n; k++) {
+                    double vkp = v[p * n + k], vkq = v[q * n + k];
+                    v[p * n + k] = c * vkp - s * vkq;
+                    v[q * n + k] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+    for (int i = 0; i < n; i++) d[i] = a[i * n + i];
+}
+
+// B and D from the covariance matrix, C = B diag(D^2) B^T
+static void update_eigen(Cmaes *es) {
+    int n = es->n;
+    double *a = (double*) R_alloc(n * n, sizeof(double));
+    memcpy(a, es->C, n * n * sizeof(double));
+    eigen_sym(n, a, es->B, es->D);
+    for (int i = 0; i < n; i++) {
+        // rounding errors can make tiny eigenvalues negative
+        es->D[i] = sqrt(fmax(es->D[i], DBL_MIN));
+    }
+    es->eigeneval = es->counteval;
+}
+
+/***** Sorting *****/
+
+// stable bottom-up merge sort of the candidate indices by fitness
+static void sort_fitness(int *idx, int *tmp, int n, const double *f) {
+    for (int i = 0; i < n; i++) idx[i] = i;
+    for (int width = 1; width < n; width *= 2) {
+        for (int lo = 0; lo < n; lo += 2 * width) {
+            int mid = lo + width < n ? lo + width : n;
+            int hi = lo + 2 * width < n ? lo + 2 * width : n;
+            int i = lo, j = mid, t = lo;
+            while (i < mid && j < hi) {
+                tmp[t++] = f[idx[j]] < f[idx[i]] ? idx[j++] : idx[i++];
+            }
+            while (i < mid) tmp[t++] = idx[i++];
+            while (j < hi) tmp[t++] = idx[j++];
+        }
+        memcpy(idx, tmp, n * sizeof(int));
+    }
+}
+
+/***** Stop criteria *****/
+
+static int stop_code(const Cmaes *es) {
+    int n = es->n;
+    const double *f = es->fitness;
+
+    int tol_x = 1;
+    for (int i = 0; i < n; i++) {
+        if (es->sigma * fmax(fabs(es->pc[i]), sqrt(es->C[i * n + i])) >= es->tol_x) {
+            tol_x = 0;
+            break;
+        }
+    }
+    if (tol_x) return CMAES_TOL_X;
+
+    // range of the best fitness values of the last generations and of the current generation
+    if (es->hist_len >= es->hist_cap) {
+        double lo = R_PosInf, hi = R_NegInf;
+        for (int g = 0; g < es->hist_cap; g++) {
+            lo = fmin(lo, es->hist[g]);
+            hi = fmax(hi, es->hist[g]);
+        }
+        for (int k = 0; k < es->lambda; k++) {
+            lo = fmin(lo, f[k]);
+            hi = fmax(hi, f[k]);
+        }
+        if (hi - lo < es->tol_fun) return CMAES_TOL_FUN;
+    }
+
+    double d_min = R_PosInf, d_max = 0.0;
+    for (int i = 0; i < n; i++) {
+        d_min = fmin(d_min, es->D[i]);
+        d_max = fmax(d_max, es->D[i]);
+    }
+    if (d_max > 1e7 * d_min) return CMAES_CONDITION;
+
+    // a step of 0.1 sigma along one principal axis does not change the mean
+    int a = es->n_gen % n, no_effect = 1;
+    for (int i = 0; i < n; i++) {
+        double xi = es->xmean[i];
+        if (xi + 0.1 * es->sigma * es->D[a] * es->B[a * n + i] != xi) {
+            no_effect = 0;
+            break;
+        }
+    }
+    if (no_effect) return CMAES_NO_EFFECT_AXIS;
+
+    for (int i = 0; i < n; i++) {
+        double xi = es->xmean[i];
+        if (xi + 0.2 * es->sigma * sqrt(es->C[i * n + i]) == xi) return CMAES_NO_EFFECT_COORD;
+    }
+    return CMAES_CONTINUE;
+}
+
+/***** Interface *****/
+
+SEXP c_cmaes_init(SEXP s_mean, SEXP s_sigma, SEXP s_lambda, SEXP s_tol) {
+    int n = length(s_mean);
+    int lambda = asInteger(s_lambda);
+    double sigma = asReal(s_sigma);
+    if (n < 1) error("Search space must have at least one dimension");
+    if (lambda < 2) error("Population size must be at least 2");
+    if (!R_FINITE(sigma) || sigma <= 0) error("Step size must be positive");
+    if (length(s_tol) != 2) error("Expected two tolerances");
+
+    Cmaes *es = (Cmaes*) calloc(1, sizeof(Cmaes));
+    if (es == NULL) error("Could not allocate memory for CMA-ES state");
+    es->n = n;
+    es->lambda = lambda;
+    es->mu = lambda / 2;
+    es->sigma = sigma;
+    es->tol_x = REAL(s_tol)[0];
+    es->tol_fun = REAL(s_tol)[1];
+    es->hist_cap = 10 + (int) ceil(30.0 * n / lambda);
+
+    // all vectors share one block and all indices another, see cmaes_free()
+    size_t n_dbl = es->mu + 4 * n + 2 * (size_t) n * n + n + 3 * (size_t) n * lambda + lambda + es->hist_cap + n;
+    double *block = (double*) calloc(n_dbl, sizeof(double));
+    int *iblock = (int*) calloc(2 * lambda, sizeof(int));
+    if (block == NULL || iblock == NULL) {
+        free(block);
+        free(iblock);
+        free(es);
+        error("Could not allocate memory for CMA-ES state");
+    }
+    es->weights = block; block += es->mu;
+    es->xmean = block; block += n;
+    es->xold = block; block += n;
+    es->pc = block; block += n;
+    es->ps = block; block += n;
+    es->C = block; block += n * n;
+    es->B = block; block += n * n;
+    es->D = block; block += n;
+    es->arz = block; block += n * lambda;
+    es->ary = block; block += n * lambda;
+    es->arx = block; block += n * lambda;
+    es->fitness = block; block += lambda;
+    es->hist = block; block += es->hist_cap;
+    es->tmp = block;
+    es->idx = iblock;
+    es->idx_tmp = iblock + lambda;
+
+    SEXP s_ptr = PROTECT(R_MakeExternalPtr(es, Rf_install("bbotk_cmaes"), R_NilValue));
+    R_RegisterCFinalizerEx(s_ptr, cmaes_finalizer, TRUE);
+
+    memcpy(es->xmean, REAL(s_mean), n * sizeof(double));
+    for (int i = 0; i < n; i++) {
+        es->C[i * n + i] = 1.0;
+        es->B[i * n + i] = 1.0;
+        es->D[i] = 1.0;
+    }
+
+    // strategy parameters
+    int mu = es->mu;
+    double sum_w = 0.0, sum_w2 = 0.0;
+    for (int i = 0; i < mu; i++) {
+        es->weights[i] = log(mu + 0.5) - log(i + 1.0);
+        sum_w += es->weights[i];
+    }
+    for (int i = 0; i < mu; i++) {
+        es->weights[i] /= sum_w;
+        sum_w2 += es->weights[i] * es->weights[i];
+    }
+    double mueff = 1.0 / sum_w2;
+    es->mueff = mueff;
+    es->cc = (4.0 + mueff / n) / (n + 4.0 + 2.0 * mueff / n);
+    es->cs = (mueff + 2.0) / (n + mueff + 5.0);
+    es->c1 = 2.0 / ((n + 1.3) * (n + 1.3) + mueff);
+    es->cmu = fmin(1.0 - es->c1, 2.0 * (mueff - 2.0 + 1.0 / mueff) / ((n + 2.0) * (n + 2.0) + mueff));
+    es->damps = 1.0 + 2.0 * fmax(0.0, sqrt((mueff - 1.0) / (n + 1.0)) - 1.0) + es->cs;
+    es->chiN = sqrt((double) n) * (1.0 - 1.0 / (4.0 * n) + 1.0 / (21.0 * n * n));
+
+    UNPROTECT(1); // s_ptr
+    return s_ptr;
+}
+
+SEXP c_cmaes_ask(SEXP s_ptr) {
+    Cmaes *es = get_cmaes(s_ptr);
+    int n = es->n, lambda = es->lambda;
+
+    GetRNGstate();
+    for (int k = 0; k < lambda; k++) {
+        double *z = es->arz + k * n, *y = es->ary + k * n, *x = es->arx + k * n;
+        for (int i = 0; i < n; i++) {
+            z[i] = norm_rand();
+            es->tmp[i] = es->D[i] * z[i];
+        }
+        // y = B D z is distributed as N(0, C)
+        for (int i = 0; i < n; i++) {
+            double s = 0.0;
+            for (int j = 0; j < n; j++) s += es->B[j * n + i] * es->tmp[j];
+            y[i] = s;
+            x[i] = es->xmean[i] + es->sigma * s;
+        }
+    }
+    PutRNGstate();
+    es->n_sampled = 1;
+
+    SEXP s_res = PROTECT(allocMatrix(REALSXP, n, lambda));
+    memcpy(REAL(s_res), es->arx, (size_t) n * lambda * sizeof(double));
+    UNPROTECT(1); // s_res
+    return s_res;
+}
+
+SEXP c_cmaes_tell(SEXP s_ptr, SEXP s_fitness) {
+    Cmaes *es = get_cmaes(s_ptr);
+    int n = es->n, lambda = es->lambda, mu = es->mu;
+    if (!es->n_sampled) error("No candidates were sampled since the last update");
+    if (length(s_fitness) != lambda) error("Expected %i fitness values", lambda);
+
+    double *f = es->fitness;
+    const double *fit = REAL(s_fitness);
+    for (int k = 0; k < lambda; k++) {
+        // failed evaluations are the worst candidates
+        f[k] = ISNAN(fit[k]) ? R_PosInf : fit[k];
+    }
+    es->n_sampled = 0;
+    es->n_gen++;
+    es->counteval += lambda;
+    sort_fitness(es->idx, es->idx_tmp, lambda, f);
+    const int *idx = es->idx;
+    const double *w = es->weights;
+
+    // recombination, ymean = (xmean - xold) / sigma and zmean = D^-1 B^T ymean
+    double *ymean = es->tmp;
+    double *zmean = (double*) R_alloc(n, sizeof(double));
+    memcpy(es->xold, es->xmean, n * sizeof(double));
+    for (int i = 0; i < n; i++) {
+        double sx = 0.0, sy = 0.0, sz = 0.0;
+        for (int r = 0; r < mu; r++) {
+            int k = idx[r];
+            sx += w[r] * es->arx[k * n + i];
+            sy += w[r] * es->ary[k * n + i];
+            sz += w[r] * es->arz[k * n + i];
+        }
+        es->xmean[i] = sx;
+        ymean[i] = sy;
+        zmean[i] = sz;
+    }
+
+    // cumulation of the evolution paths, C^-1/2 ymean = B zmean
+    double cs = es->cs, cc = es->cc, mueff = es->mueff;
+    double fac_s = sqrt(cs * (2.0 - cs) * mueff), norm_ps = 0.0;
+    for (int i = 0; i < n; i++) {
+        double s = 0.0;
+        for (int j = 0; j < n; j++) s += es->B[j * n + i] * zmean[j];
+        es->ps[i] = (1.0 - cs) * es->ps[i] + fac_s * s;
+        norm_ps += es->ps[i] * es->ps[i];
+    }
+    norm_ps = sqrt(norm_ps);
+    double hsig = norm_ps / sqrt(1.0 - pow(1.0 - cs, 2.0 * es->counteval / lambda)) / es->chiN < 1.4 + 2.0 / (n + 1.0);
+    double fac_c = hsig * sqrt(cc * (2.0 - cc) * mueff);
+    for (int i = 0; i < n; i++) {
+        es->pc[i] = (1.0 - cc) * es->pc[i] + fac_c * ymean[i];
+    }
+
+    // rank-one and rank-mu update of the covariance matrix
+    double c1 = es->c1, cmu = es->cmu;
+    double old = 1.0 - c1 - cmu + c1 * (1.0 - hsig) * cc * (2.0 - cc);
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i <= j; i++) {
+            double s = 0.0;
+            for (int r = 0; r < mu; r++) {
+                const double *y = es->ary + idx[r] * n;
+                s += w[r] * y[i] * y[j];
+            }
+            double c = old * es->C[j * n + i] + c1 * es->pc[i] * es->pc[j] + cmu * s;
+            es->C[j * n + i] = c;
+            es->C[i * n + j] = c;
+        }
+    }
+
+    // step-size adaptation, increased if the fitness is flat
+    es->sigma *= exp((cs / es->damps) * (norm_ps / es->chiN - 1.0));
+    if (f[idx[0]] == f[idx[(int) ceil(0.7 * lambda) - 1]]) {
+        es->sigma *= exp(0.2 + cs / es->damps);
+    }
+
+    // the decomposition is updated lazily to keep its cost at O(n^2) per evaluation
+    if (es->counteval - es->eigeneval > lambda / (c1 + cmu) / n / 10.0) {
+        update_eigen(es);
+    }
+
+    if (es->hist_len >= es->hist_cap) {
+        memmove(es->hist, es->hist + 1, (es->hist_cap - 1) * sizeof(double));
+        es->hist_len = es->hist_cap - 1;
+    }
+    es->hist[es->hist_len++] = f[idx[0]];
+
+    return ScalarInteger(stop_code(es));
+}
@@ -0,0 +1,20 @@
+#ifndef CMAES_H
+#define CMAES_H
+
+#include <R.h>
+#include <Rinternals.h>
+
+// see docs in R/OptimizerBatchCmaes.R
+
+// create the state of a CMA-ES run with the initial mean, step size and population size.
+// returns an external pointer, the state is freed by its finalizer.
+SEXP c_cmaes_init(SEXP s_mean, SEXP s_sigma, SEXP s_lambda, SEXP s_tol);
+
+// sample a generation, returns a n x lambda matrix with one candidate per column
+SEXP c_cmaes_ask(SEXP s_ptr);
+
+// update the state with the fitness (minimized) of the candidates of the last c_cmaes_ask call.
+// returns the stop code, 0 if none of the stop criteria is met.
+SEXP c_cmaes_tell(SEXP s_ptr, SEXP s_fitness);
+
+#endif // CMAES_H
@@ -0,0 +1,201 @@
+#include "design.h"
+#include "local_search.h"
+
+#include <Rmath.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// Designs over the numeric parameters of a search space,
+// factors and logicals are sampled uniformly and the dependencies are repaired afterwards.
+// all random numbers come from R's RNG, so designs are reproducible with set.seed().
+
+enum {
+    DESIGN_RANDOM = 0,
+    DESIGN_LHS = 1,
+    DESIGN_SOBOL = 2
+};
+
+#define SOBOL_BITS 32
+#define SOBOL_MAX_DIM 40
+
+// primitive polynomials and initial direction numbers of the dimensions 2 to 40 of Joe and Kuo (2008):
+// degree s, coefficients a of the inner terms, initial direction numbers m_1, ..., m_s
+typedef struct {
+    int s;
+    int a;
+    int m[8];
+} SobolPoly;
+
+static const SobolPoly sobol_polys[SOBOL_MAX_DIM - 1] = {
+    {1, 0, {1}},
+    {2, 1, {1, 3}},
+    {3, 1, {1, 3, 1}},
+    {3, 2, {1, 1, 1}},
+    {4, 1, {1, 1, 3, 3}},
+    {4, 4, {1, 3, 5, 13}},
+    {5, 2, {1, 1, 5, 5, 17}},
+    {5, 4, {1, 1, 5, 5, 5}},
+    {5, 7, {1, 1, 7, 11, 19}},
+    {5, 11, {1, 1, 5, 1, 1}},
+    {5, 13, {1, 1, 1, 3, 11}},
+    {5, 14, {1, 3, 5, 5, 31}},
+    {6, 1, {1, 3, 3, 9, 7, 49}},
+    {6, 13, {1, 1, 1, 15, 21, 21}},
+    {6, 16, {1, 3, 1, 13, 27, 49}},
+    {6, 19, {1, 1, 1, 15, 7, 5}},
+    {6, 22, {1, 3, 1, 15, 13, 25}},
+    {6, 25, {1, 1, 5, 5, 19, 61}},
+    {7, 1, {1, 3, 7, 11, 23, 15, 103}},
+    {7, 4, {1, 3, 7, 13, 13, 15, 69}},
+    {7, 7, {1, 1, 3, 13, 7, 35, 63}},
+    {7, 8, {1, 3, 5, 9, 1, 25, 53}},
+    {7, 14, {1, 3, 1, 13, 9, 35, 107}},
+    {7, 19, {1, 3, 1, 5, 27, 61, 31}},
+    {7, 21, {1, 1, 5, 11, 19, 41, 61}},
+    {7, 28, {1, 3, 5, 3, 3, 13, 69}},
+    {7, 31, {1, 1, 7, 13, 1, 19, 1}},
+    {7, 32, {1, 3, 7, 5, 13, 19, 59}},
+    {7, 37, {1, 1, 3, 9, 25, 29, 41}},
+    {7, 41, {1, 3, 5, 13, 23, 1, 55}},
+    {7, 42, {1, 3, 7, 3, 13, 59, 17}},
+    {7, 50, {1, 3, 1, 3, 5, 53, 69}},
+    {7, 55, {1, 1, 5, 5, 23, 33, 13}},
+    {7, 56, {1, 1, 7, 7, 1, 61, 123}},
+    {7, 59, {1, 1, 7, 9, 13, 61, 49}},
+    {7, 62, {1, 3, 3, 5, 3, 55, 33}},
+    {8, 14, {1, 3, 1, 15, 31, 13, 49, 245}},
+    {8, 21, {1, 3, 5, 15, 31, 59, 63, 97}},
+    {8, 22, {1, 3, 1, 11, 11, 11, 77, 249}},
+};
+
+static inline uint32_t random_bits32(void) {
+    return (uint32_t) (unif_rand() * 4294967296.0);
+}
+
+static inline int parity32(uint32_t x) {
+    x ^= x >> 16;
+    x ^= x >> 8;
+    x ^= x >> 4;
+    x ^= x >> 2;
+    x ^= x >> 1;
+    return (int) (x & 1);
+}
+
+// n values of one dimension of a Latin hypercube, one in each of the intervals [k / n, (k + 1) / n)
+static void lhs_column(double *u, int n, int *perm) {
+    for (int i = 0; i < n; i++) perm[i] = i;
+    for (int i = n - 1; i > 0; i--) {
+        int k = (int) R_unif_index(i + 1.0);
+        int tmp = perm[i];
+        perm[i] = perm[k];
+        perm[k] = tmp;
+    }
+    for (int i = 0; i < n; i++) u[i] = (perm[i] + unif_rand()) / n;
+}
+
+// n points of dimension dim (0-based) of a Sobol sequence, scrambled with a random linear matrix
+// and a random digital shift (Matousek, 1998). each dimension is generated on its own in Gray code order.
+static void sobol_column(double *u, int n, int dim) {
+    uint32_t v[SOBOL_BITS + 1];
+    for (int k = 1; k <= SOBOL_BITS; k++) {
+        if (dim == 0) {
+            v[k] = (uint32_t) 1 << (SOBOL_BITS - k);
+            continue;
+        }
+        const SobolPoly *p = &sobol_polys[dim - 1];
+        int s = p->s;
+        if (k <= s) {
+            v[k] = (uint32_t) p->m[k - 1] << (SOBOL_BITS - k);
+        } else {
+            uint32_t x = v[k - s] ^ (v[k - s] >> s);
+            for (int l = 1; l < s; l++) {
+                if ((p->a >> (s - 1 - l)) & 1) x ^= v[k - l];
+            }
+            v[k] = x;
+        }
+    }
+
+    // random lower triangular matrix with unit diagonal, row l has the bits of the l most significant digits
+    uint32_t rows[SOBOL_BITS];
+    for (int l = 0; l < SOBOL_BITS; l++) {
+        int pos = SOBOL_BITS - 1 - l;
+        uint32_t above = pos == SOBOL_BITS - 1 ? 0 : ~(uint32_t) 0 << (pos + 1);
+        rows[l] = (random_bits32() & above) | ((uint32_t) 1 << pos);
+    }
+    for (int k = 1; k <= SOBOL_BITS; k++) {
+        uint32_t x = 0;
+        for (int l = 0; l < SOBOL_BITS; l++) {
+            if (parity32(v[k] & rows[l])) x |= (uint32_t) 1 << (SOBOL_BITS - 1 - l);
+        }
+        v[k] = x;
+    }
+    uint32_t shift = random_bits32();
+
+    uint32_t x = 0;
+    for (int i = 0; i < n; i++) {
+        if (i > 0) {
+            // the Gray codes of i - 1 and i differ in the lowest zero bit of i - 1
+            int c = 1;
+            for (uint32_t j = (uint32_t) (i - 1); j & 1; j >>= 1) c++;
+            x ^= v[c];
+        }
+        u[i] = ((double) (x ^ shift) + 0.5) / 4294967296.0;
+    }
+}
+
+SEXP c_sample_design(SEXP s_ss, SEXP s_n, SEXP s_method) {
+    SearchSpace ss;
+    get_search_space(s_ss, &ss);
+    int n = asInteger(s_n);
+    int method = asInteger(s_method);
+    if (n == NA_INTEGER || n < 0) error("Number of points must be a non-negative integer");
+
+    int n_numeric = 0;
+    for (int j = 0; j < ss.n_params; j++) {
+        if (ss.param_classes[j] <= 1) n_numeric++;
+    }
+    if (method == DESIGN_SOBOL && n_numeric > SOBOL_MAX_DIM) {
+        error("Sobol sequences are supported for at most %i numeric parameters", SOBOL_MAX_DIM);
+    }
+
+    Configs cfg;
+    cfg_alloc(&cfg, n, &ss);
+    double *u = (double*) R_alloc(n > 0 ? n : 1, sizeof(double));
+    int *perm = method == DESIGN_LHS ? (int*) R_alloc(n > 0 ? n : 1, sizeof(int)) : NULL;
+
+    GetRNGstate();
+    int dim = 0;
+    for (int j = 0; j < ss.n_params; j++) {
+        int param_class = ss.param_classes[j];
+        if (param_class > 1 || method == DESIGN_RANDOM) {
+            for (int i = 0; i < n; i++) cfg_set_random(&cfg, i, j, &ss, NULL);
+            continue;
+        }
+        if (method == DESIGN_LHS) {
+            lhs_column(u, n, perm);
+        } else {
+            sobol_column(u, n, dim);
+        }
+        dim++;
+        double lower = ss.lower[j], upper = ss.upper[j];
+        if (param_class == 0) { // ParamDbl
+            for (int i = 0; i < n; i++) cfg.dbl[j][i] = lower + u[i] * (upper - lower);
+        } else { // ParamInt
+            for (int i = 0; i < n; i++) {
+                double value = floor(lower + u[i] * (upper - lower + 1.0));
+                cfg.ints[j][i] = (int) (value > upper ? upper : value);
+            }
+        }
+    }
+    // inactive params are set to NA, all params have a value, so the repair draws no random numbers
+    if (ss.n_conds > 0) {
+        for (int i = 0; i < n; i++) cfg_repair_row(&cfg, i, &ss, NULL);
+    }
+    PutRNGstate();
+
+    SEXP s_dt = PROTECT(dt_generate(n, &ss));
+    cfg_to_dt(&cfg, NULL, n, s_dt, &ss);
+    UNPROTECT(1); // s_dt
+    return s_dt;
+}
@@ -0,0 +1,15 @@
+#ifndef DESIGN_H
+#define DESIGN_H
+
+#include <R.h>
+#include <Rinternals.h>
+
+// see docs in R/sample_design.R
+
+// sample n points of a search space (a paradox ParamSet or a compiled search space of local_search_compile).
+// the numeric parameters are sampled with method 0 (uniform), 1 (Latin hypercube) or 2 (scrambled Sobol),
+// the others uniformly. inactive parameters are NA.
+// returns a data.table in search space order.
+SEXP c_sample_design(SEXP s_ss, SEXP s_n, SEXP s_method);
+
+#endif // DESIGN_H
@@ -0,0 +1,136 @@
+#include "grid_design.h"
+#include "local_search.h"
+
+#include <stdint.h>
+#include <math.h>
+
+// Lazy grid design.
+// Position p of the random order is mapped to a linear index of the Cartesian grid by a keyed permutation,
+// the index is decoded into one value per parameter (mixed radix, first parameter fastest).
+// Nothing is materialized, so the memory does not depend on the size of the grid.
+//
+// With dependencies, all combinations which only differ in the values of inactive parameters
+// are the same point. We only keep the combination where all inactive parameters have their first value,
+// so every point of the grid is returned exactly once.
+
+#define GRID_FEISTEL_ROUNDS 4
+#define GRID_MAX_BITS 62
+
+typedef struct {
+    uint64_t size;      // number of combinations of the Cartesian grid
+    uint64_t half_mask; // the permutation runs on 2 * half_bits bits and walks the cycle back into [0, size)
+    int half_bits;
+    uint64_t keys[GRID_FEISTEL_ROUNDS];
+} GridPerm;
+
+static void grid_perm_init(GridPerm *perm, uint64_t size, uint64_t key) {
+    perm->size = size;
+    perm->half_bits = 1;
+    while (perm->half_bits < GRID_MAX_BITS / 2 && ((uint64_t) 1 << (2 * perm->half_bits)) < size) perm->half_bits++;
+    perm->half_mask = ((uint64_t) 1 << perm->half_bits) - 1;
+    for (int r = 0; r < GRID_FEISTEL_ROUNDS; r++) {
+        key = mix64(key + 0x9e3779b97f4a7c15ULL);
+        perm->keys[r] = key;
+    }
+}
+
+// balanced Feistel network, a bijection of [0, 2^(2 * half_bits)),
+// applied again until the result is in [0, size), which keeps it a bijection of [0, size)
+static uint64_t grid_perm_apply(const GridPerm *perm, uint64_t x) {
+    do {
+        uint64_t left = x >> perm->half_bits, right = x & perm->half_mask;
+        for (int r = 0; r < GRID_FEISTEL_ROUNDS; r++) {
+            uint64_t tmp = right;
+            right = left ^ (mix64(right ^ perm->keys[r]) & perm->half_mask);
+            left = tmp;
+        }
+        x = (left << perm->half_bits) | right;
+    } while (x >= perm->size);
+    return x;
+}
+
+SEXP c_grid_design_points(SEXP s_ss, SEXP s_values, SEXP s_key, SEXP s_position, SEXP s_end, SEXP s_n) {
+    SearchSpace ss;
+    get_search_space(s_ss, &ss);
+    int n = asInteger(s_n);
+    if (n == NA_INTEGER || n < 0) error("Number of points must be a non-negative integer");
+    if (TYPEOF(s_values) != VECSXP || length(s_values) != ss.n_params) {
+        error("Grid values must be a list with one element per parameter");
+    }
+
+    // number of values per parameter and the size of the grid
+    int *radix = (int*) R_alloc(ss.n_params, sizeof(int));
+    const double **values = (const double**) R_alloc(ss.n_params, sizeof(double*));
+    uint64_t size = 1;
+    for (int j = 0; j < ss.n_params; j++) {
+        int param_class = ss.param_classes[j];
+        SEXP s_v = VECTOR_ELT(s_values, j);
+        values[j] = NULL;
+        if (param_class <= 1) { // ParamDbl, ParamInt
+            if (TYPEOF(s_v) != REALSXP || length(s_v) == 0) {
+                error("Grid values of parameter '%s' must be a non-empty numeric vector", ss.param_names[j]);
+            }
+            values[j] = REAL(s_v);
+            radix[j] = length(s_v);
+        } else {
+            radix[j] = param_class == 2 ? ss.n_levels[j] : 2;
+        }
+        if (size > ((uint64_t) 1 << GRID_MAX_BITS) / (uint64_t) radix[j]) {
+            error("Grid has more than 2^%i points", GRID_MAX_BITS);
+        }
+        size *= (uint64_t) radix[j];
+    }
+
+    if (TYPEOF(s_key) != REALSXP || length(s_key) != 2) error("Key must be a numeric vector of length 2");
+    double *key = REAL(s_key);
+    GridPerm perm;
+    grid_perm_init(&perm, size, ((uint64_t) key[0] << 32) | (uint64_t) key[1]);
+
+    double position = asReal(s_position), end = asReal(s_end);
+    if (!(position >= 0)) error("Position must be non-negative");
+    uint64_t p = (uint64_t) position;
+    uint64_t p_end = end < (double) size ? (uint64_t) end : size;
+
+    Configs cfg;
+    cfg_alloc(&cfg, n, &ss);
+    int *digits = (int*) R_alloc(ss.n_params > 0 ? ss.n_params : 1, sizeof(int));
+    int n_points = 0;
+    for (; p < p_end && n_points < n; p++) {
+        uint64_t index = grid_perm_apply(&perm, p);
+        int i = n_points;
+        for (int j = 0; j < ss.n_params; j++) {
+            int d = (int) (index % (uint64_t) radix[j]);
+            index /= (uint64_t) radix[j];
+            digits[j] = d;
+            bit_set(cfg.na[j], i, 0);
+            int param_class = ss.param_classes[j];
+            if (param_class == 0) { // ParamDbl
+                cfg.dbl[j][i] = values[j][d];
+            } else if (param_class == 1) { // ParamInt
+                cfg.ints[j][i] = (int) values[j][d];
+            } else if (param_class == 2) { // ParamFct
+                cfg.ints[j][i] = d;
+            } else { // ParamLgl
+                bit_set(cfg.lgl[j], i, d);
+            }
+        }
+        if (ss.n_conds > 0) {
+            // all params have a value, so the repair only sets inactive params to NA
+            cfg_repair_row(&cfg, i, &ss, NULL);
+            int duplicate = 0;
+            for (int j = 0; j < ss.n_params && !duplicate; j++) {
+                duplicate = digits[j] != 0 && cfg_is_na(&cfg, i, j);
+            }
+            if (duplicate) continue;
+        }
+        n_points++;
+    }
+
+    SEXP s_res = PROTECT(allocVector(VECSXP, 2));
+    SEXP s_dt = PROTECT(dt_generate(n_points, &ss));
+    cfg_to_dt(&cfg, NULL, n_points, s_dt, &ss);
+    SET_VECTOR_ELT(s_res, 0, s_dt);
+    SET_VECTOR_ELT(s_res, 1, ScalarReal((double) p));
+    UNPROTECT(2); // s_res, s_dt
+    return s_res;
+}
@@ -0,0 +1,16 @@
+#ifndef GRID_DESIGN_H
+#define GRID_DESIGN_H
+
+#include <R.h>
+#include <Rinternals.h>
+
+// see docs in R/grid_design.R
+
+// the points of a grid at the positions `position` to `end` - 1 of a random permutation of the grid, at most n of them.
+// the grid is the Cartesian product of the values per parameter (s_values, NULL for factors and logicals,
+// which use all levels), the permutation is defined by the 64-bit key in s_key (two 32-bit halves).
+// combinations which only differ in inactive parameters are returned once.
+// returns a list with the data.table of the points and the next position.
+SEXP c_grid_design_points(SEXP s_ss, SEXP s_values, SEXP s_key, SEXP s_position, SEXP s_end, SEXP s_n);
+
+#endif // GRID_DESIGN_H
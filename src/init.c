@@ -3,11 +3,22 @@
 #include <Rinternals.h>
 #include <stdlib.h> // for NULL
 
+#include "cmaes.h"
+#include "design.h"
+#include "grid_design.h"
 #include "local_search.h"
+#include "nds_selection.h"
 #include "test_local_search.h"
 
 static const R_CallMethodDef CallEntries[] = {
+    {"c_cmaes_init", (DL_FUNC)&c_cmaes_init, 4},
+    {"c_cmaes_ask", (DL_FUNC)&c_cmaes_ask, 1},
+    {"c_cmaes_tell", (DL_FUNC)&c_cmaes_tell, 2},
+    {"c_grid_design_points", (DL_FUNC)&c_grid_design_points, 6},
     {"c_local_search", (DL_FUNC)&c_local_search, 4},
+    {"c_local_search_compile", (DL_FUNC)&c_local_search_compile, 1},
+    {"c_nds_selection", (DL_FUNC)&c_nds_selection, 3},
+    {"c_sample_design", (DL_FUNC)&c_sample_design, 3},
 
     {"c_test_random_int", (DL_FUNC)&c_test_random_int, 0},
     {"c_test_get_list_el_by_name", (DL_FUNC)&c_test_get_list_el_by_name, 1},
@@ -20,11 +31,17 @@ static const R_CallMethodDef CallEntries[] = {
     {"c_test_copy_best_neighs_to_pop", (DL_FUNC)&c_test_copy_best_neighs_to_pop, 6},
     {"c_test_get_best_pop_element", (DL_FUNC)&c_test_get_best_pop_element, 4},
     {"c_test_dt_repair_row", (DL_FUNC)&c_test_dt_repair_row, 2},
+    {"c_test_repair_descendants", (DL_FUNC)&c_test_repair_descendants, 3},
     {"c_test_restart_stagnated_searches", (DL_FUNC)&c_test_restart_stagnated_searches, 5},
     {"c_test_dt_set_random_row", (DL_FUNC)&c_test_dt_set_random_row, 2},
+    {"c_test_cache", (DL_FUNC)&c_test_cache, 2},
+    {"c_test_native_objective", (DL_FUNC)&c_test_native_objective, 0},
     {NULL, NULL, 0}};
 
 void R_init_bbotk(DllInfo *dll) {
   R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
   R_useDynamicSymbols(dll, FALSE);
+  // so other packages can run the local search from C, see inst/include/bbotk.h
+  R_RegisterCCallable("bbotk", "c_local_search", (DL_FUNC)&c_local_search);
+  R_RegisterCCallable("bbotk", "c_local_search_compile", (DL_FUNC)&c_local_search_compile);
 }
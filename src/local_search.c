@@ -6,143 +6,118 @@
 #include <string.h>
 #include <math.h>
 #include <assert.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-// print a data.table row (for debugging)
-void dt_print_row(SEXP dt, int row) {
+// print a single config row (for debugging)
+void cfg_print_row(const Configs *cfg, int row, const SearchSpace *ss) {
 #if DEBUG_ENABLED
-    int ncol = length(dt);
-    if (ncol == 0) {
-        Rprintf("<empty data.table>\n");
-        return;
-    }
-    SEXP s_col_names = getAttrib(dt, R_NamesSymbol);
-    // Print column names
-    for (int j = 0; j < ncol; j++) {
-        Rprintf("%10s ", CHAR(STRING_ELT(s_col_names, j)));
+    for (int j = 0; j < ss->n_params; j++) {
+        Rprintf("%10s ", ss->param_names[j]);
     }
     Rprintf("\n");
-    for (int j = 0; j < ncol; j++) {
-        SEXP col = VECTOR_ELT(dt, j);
-        switch(TYPEOF(col)) {
-            case REALSXP:
-                Rprintf("%10.4f ", REAL(col)[row]);
-                break;
-            case INTSXP:
-                Rprintf("%10d ", INTEGER(col)[row]);
+    for (int j = 0; j < ss->n_params; j++) {
+        if (cfg_is_na(cfg, row, j)) {
+            Rprintf("%10s ", "NA");
+            continue;
+        }
+        switch (ss->param_classes[j]) {
+            case 0:
+                Rprintf("%10.4f ", cfg->dbl[j][row]);
                 break;
-            case LGLSXP:
-                Rprintf("%10s ", LOGICAL(col)[row] ? "TRUE" : "FALSE");
+            case 1:
+                Rprintf("%10d ", cfg->ints[j][row]);
                 break;
-            case STRSXP:
-                Rprintf("%10s ", CHAR(STRING_ELT(col, row)));
+            case 2:
+                Rprintf("%10s ", ss->level_names[j][cfg->ints[j][row]]);
                 break;
             default:
-                Rprintf("%10s ", "?");
+                Rprintf("%10s ", bit_get(cfg->lgl[j], row) ? "TRUE" : "FALSE");
         }
     }
     Rprintf("\n");
+#else
+    (void) cfg;
+    (void) row;
+    (void) ss;
 #endif
 }
-// print a data.table (for debugging)
-void dt_print(SEXP dt, int nrows_max) {
+
+// print the first rows of a block of configs (for debugging)
+void cfg_print(const Configs *cfg, int nrows_max, const SearchSpace *ss) {
 #if DEBUG_ENABLED
-    int ncol = length(dt);
-    if (ncol == 0) {
-        Rprintf("<empty data.table>\n");
-        return;
-    }
-    SEXP s_col_names = getAttrib(dt, R_NamesSymbol);
-    int nrow = length(VECTOR_ELT(dt, 0));
-    if (nrow == 0) {
-        Rprintf("<data.table with 0 rows>\n");
+    if (cfg->n_rows == 0) {
+        Rprintf("<configs with 0 rows>\n");
         return;
     }
-    int nrows = nrow < nrows_max ? nrow : nrows_max;
-    // Print column names
-    for (int j = 0; j < ncol; j++) {
-        Rprintf("%10s ", CHAR(STRING_ELT(s_col_names, j)));
-    }
-    Rprintf("\n");
-    // Print rows
+    int nrows = cfg->n_rows < nrows_max ? cfg->n_rows : nrows_max;
     for (int i = 0; i < nrows; i++) {
-        for (int j = 0; j < ncol; j++) {
-            SEXP col = VECTOR_ELT(dt, j);
-            switch(TYPEOF(col)) {
-                case REALSXP:
-                    Rprintf("%10.4f ", REAL(col)[i]);
-                    break;
-                case INTSXP:
-                    Rprintf("%10d ", INTEGER(col)[i]);
-                    break;
-                case LGLSXP:
-                    Rprintf("%10s ", LOGICAL(col)[i] ? "TRUE" : "FALSE");
-                    break;
-                case STRSXP:
-                    Rprintf("%10s ", CHAR(STRING_ELT(col, i)));
-                    break;
-                default:
-                    Rprintf("%10s ", "?");
-            }
-        }
-        Rprintf("\n");
+        cfg_print_row(cfg, i, ss);
     }
-    if (nrow > nrows) {
-        Rprintf("... (%d more rows)\n", nrow - nrows);
+    if (cfg->n_rows > nrows) {
+        Rprintf("... (%d more rows)\n", cfg->n_rows - nrows);
     }
+#else
+    (void) cfg;
+    (void) nrows_max;
+    (void) ss;
 #endif
 }
 
+// next draw of a counter-based stream, uniform in (0, 1), like unif_rand
+static inline double rng_unif(Rng *rng) {
+    uint64_t x = mix64(rng->key ^ mix64(rng->stream + 0x9e3779b97f4a7c15ULL)) + rng->counter++ * 0x9e3779b97f4a7c15ULL;
+    x = mix64(x);
+    return ((double) (x >> 11) + 0.5) * (1.0 / 9007199254740992.0); // 2^53
+}
+
+// draw a 64-bit key for the stream RNG from R's RNG, so set.seed() controls the streams
+uint64_t rng_key_from_r(void) {
+    uint64_t hi = (uint64_t) (unif_rand() * 4294967296.0);
+    uint64_t lo = (uint64_t) (unif_rand() * 4294967296.0);
+    return (hi << 32) | lo;
+}
+
+// Helper functions to get random numbers.
+// If rng is NULL we use R's RNG, they respect the RNG state and the seed,
+// otherwise the counter-based stream, which is safe to use from worker threads.
 
-// Helper function to get random number from R, they respect the RNG state and the seed
 // Helper function to get random integer between a and b (inclusive)
-int random_int(int a, int b) {
+int random_int(Rng *rng, int a, int b) {
     // Use proper integer arithmetic to avoid bias
-    return a + (int)(unif_rand() * (b - a + 1));
+    double u = rng == NULL ? unif_rand() : rng_unif(rng);
+    return a + (int)(u * (b - a + 1));
 }
 
-// Helper function to get random normal distribution
-double random_normal(double mean, double sd) {
-    return rnorm(mean, sd);
+// Helper function to get random uniform number between a and b
+double random_unif(Rng *rng, double a, double b) {
+    if (rng == NULL) return runif(a, b);
+    return a + (b - a) * rng_unif(rng);
+}
+
+// Helper function to get random normal distribution, Box-Muller for the stream RNG
+double random_normal(Rng *rng, double mean, double sd) {
+    if (rng == NULL) return rnorm(mean, sd);
+    double u1 = rng_unif(rng);
+    double u2 = rng_unif(rng);
+    return mean + sd * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
 }
 
 /************ DT functions ********** */
 
-// Check if a DT element is NA
-int dt_is_na(SEXP s_dt, int row_i, int param_j) {
-    SEXP s_col = VECTOR_ELT(s_dt, param_j);
-    switch(TYPEOF(s_col)) {
-        case REALSXP:
-            return ISNA(REAL(s_col)[row_i]);
-        case INTSXP:
-            return INTEGER(s_col)[row_i] == NA_INTEGER;
-        case LGLSXP:
-            return LOGICAL(s_col)[row_i] == NA_LOGICAL;
-        case STRSXP:
-            return STRING_ELT(s_col, row_i) == NA_STRING;
-    }
-    // this should never happen...
-    assert(0);
-    return 0;
-}
-
-// Set a DT element to NA
-void dt_set_na(SEXP s_dt, int row_i, int param_j) {
-    SEXP s_col = VECTOR_ELT(s_dt, param_j);
-    switch (TYPEOF(s_col)) {
-        case REALSXP:
-            REAL(s_col)[row_i] = NA_REAL; break;
-        case INTSXP:
-            INTEGER(s_col)[row_i] = NA_INTEGER; break;
-        case STRSXP:
-            SET_STRING_ELT(s_col, row_i, NA_STRING); break;
-        case LGLSXP:
-            LOGICAL(s_col)[row_i] = NA_LOGICAL; break;
-    }
+// compact row names c(NA, -n) of a DT with n rows
+static SEXP dt_rownames(R_xlen_t n) {
+    SEXP s_rownames = allocVector(INTSXP, 2);
+    INTEGER(s_rownames)[0] = NA_INTEGER;
+    INTEGER(s_rownames)[1] = (int) -n;
+    return s_rownames;
 }
 
 // Create an uninitialized data.table with col types from SearchSpace
 // Return DT must be protected by the caller
-SEXP dt_generate(int n, SearchSpace* ss) {
+SEXP dt_generate(int n, const SearchSpace* ss) {
     SEXP s_dt = PROTECT(allocVector(VECSXP, ss->n_params));
     for (int j = 0; j < ss->n_params; j++) {
         int param_class = ss->param_classes[j];
@@ -173,10 +148,7 @@ SEXP dt_generate(int n, SearchSpace* ss) {
     setAttrib(s_dt, R_ClassSymbol, class_attr);
 
     // set row names
-    SEXP s_rownames = PROTECT(allocVector(INTSXP, n));
-    for (int i = 0; i < n; i++) {
-      INTEGER(s_rownames)[i] = i + 1;
-    }
+    SEXP s_rownames = PROTECT(dt_rownames(n));
     setAttrib(s_dt, R_RowNamesSymbol, s_rownames);
 
     // Set .internal.selfref attribute for data.table
@@ -187,22 +159,84 @@ SEXP dt_generate(int n, SearchSpace* ss) {
     return s_dt;
 }
 
-// Helper function mutate a single element of a config (in a DT)
-void dt_mutate_element(SEXP s_dt, int row_i, int param_j, const SearchSpace* ss, const Control* ctrl) {
+
+/************ Configs functions ********** */
+
+// Allocate storage for n_rows configs, all NA bits are cleared
+// memory is allocated with R_alloc, so it lives until the end of the .Call
+void cfg_alloc(Configs *cfg, int n_rows, const SearchSpace *ss) {
+    cfg->n_rows = n_rows;
+    cfg->n_params = ss->n_params;
+    cfg->n_words = (n_rows + 63) / 64;
+    cfg->dbl = (double**) R_alloc(ss->n_params, sizeof(double*));
+    cfg->ints = (int**) R_alloc(ss->n_params, sizeof(int*));
+    cfg->lgl = (uint64_t**) R_alloc(ss->n_params, sizeof(uint64_t*));
+    cfg->na = (uint64_t**) R_alloc(ss->n_params, sizeof(uint64_t*));
+    for (int j = 0; j < ss->n_params; j++) {
+        int param_class = ss->param_classes[j];
+        cfg->dbl[j] = NULL;
+        cfg->ints[j] = NULL;
+        cfg->lgl[j] = NULL;
+        if (param_class == 0) { // ParamDbl
+            cfg->dbl[j] = (double*) R_alloc(n_rows, sizeof(double));
+        } else if (param_class == 1 || param_class == 2) { // ParamInt, ParamFct
+            cfg->ints[j] = (int*) R_alloc(n_rows, sizeof(int));
+        } else { // ParamLgl
+            cfg->lgl[j] = (uint64_t*) R_alloc(cfg->n_words, sizeof(uint64_t));
+            memset(cfg->lgl[j], 0, cfg->n_words * sizeof(uint64_t));
+        }
+        cfg->na[j] = (uint64_t*) R_alloc(cfg->n_words, sizeof(uint64_t));
+        memset(cfg->na[j], 0, cfg->n_words * sizeof(uint64_t));
+    }
+}
+
+// Check if a config element is NA
+int cfg_is_na(const Configs *cfg, int row_i, int param_j) {
+    return bit_get(cfg->na[param_j], row_i);
+}
+
+// Set a config element to NA, we also zero the value slot, so the encoding of the row is canonical
+void cfg_set_na(Configs *cfg, int row_i, int param_j) {
+    bit_set(cfg->na[param_j], row_i, 1);
+    if (cfg->dbl[param_j] != NULL) {
+        cfg->dbl[param_j][row_i] = 0.0;
+    } else if (cfg->ints[param_j] != NULL) {
+        cfg->ints[param_j][row_i] = 0;
+    } else {
+        bit_set(cfg->lgl[param_j], row_i, 0);
+    }
+}
+
+// Copy row src_i of src to row dst_i of dst
+void cfg_copy_row(Configs *dst, int dst_i, const Configs *src, int src_i, const SearchSpace *ss) {
+    for (int j = 0; j < ss->n_params; j++) {
+        int param_class = ss->param_classes[j];
+        if (param_class == 0) { // ParamDbl
+            dst->dbl[j][dst_i] = src->dbl[j][src_i];
+        } else if (param_class == 1 || param_class == 2) { // ParamInt, ParamFct
+            dst->ints[j][dst_i] = src->ints[j][src_i];
+        } else { // ParamLgl
+            bit_set(dst->lgl[j], dst_i, bit_get(src->lgl[j], src_i));
+        }
+        bit_set(dst->na[j], dst_i, bit_get(src->na[j], src_i));
+    }
+}
+
+// Helper function mutate a single element of a config
+void cfg_mutate_element(Configs *cfg, int row_i, int param_j, const SearchSpace* ss, const Control* ctrl, Rng *rng) {
     // we only mutate elements that are not NA
-    assert(!dt_is_na(s_dt, row_i, param_j));
+    assert(!cfg_is_na(cfg, row_i, param_j));
     int param_class = ss->param_classes[param_j];
-    SEXP s_neigh_col = VECTOR_ELT(s_dt, param_j);
     if (param_class == 0) { // ParamDbl
         // normalize to [0,1], add noise, rescale to [lower, upper], clip to [lower, upper]
-        double *neigh_col = REAL(s_neigh_col);
+        double *neigh_col = cfg->dbl[param_j];
         double value = neigh_col[row_i];
         double lower = ss->lower[param_j];
         double upper = ss->upper[param_j];
         double range = upper - lower;
         if (range > 1e-8) { // avoid division by zero, be safe
           value = (value - lower) / range;
-          value += random_normal(0.0, ctrl->mut_sd);
+          value += random_normal(rng, 0.0, ctrl->mut_sd);
           value = value * range + lower;
           if (value < lower) value = lower;
           if (value > upper) value = upper;
@@ -210,56 +244,440 @@ void dt_mutate_element(SEXP s_dt, int row_i, int param_j, const SearchSpace* ss,
         }
     } else if (param_class == 1) { // ParamInt
         // same as ParamDbl but round and cast to int
-        int *neigh_col = INTEGER(s_neigh_col);
+        int *neigh_col = cfg->ints[param_j];
         double value = (double) neigh_col[row_i];
         double lower = ss->lower[param_j];
         double upper = ss->upper[param_j];
         double range = upper - lower;
         if (range > 1e-8) { // avoid division by zero, be safe
             value = (value - lower) / range;
-            value += random_normal(0.0, ctrl->mut_sd);
+            value += random_normal(rng, 0.0, ctrl->mut_sd);
             value = (int) round(value * range + lower);
             if (value < lower) value = (int) lower;
             if (value > upper) value = (int) upper;
             neigh_col[row_i] = value;
         }
     } else if (param_class == 2) {    // ParamFct
-        // sample uniformly from the other levels
+        // sample uniformly from the other levels, using the shift trick
         int n_levels = ss->n_levels[param_j];
         if (n_levels > 1) {
-            // Find current level index
-            const char* current_level = CHAR(STRING_ELT(s_neigh_col, row_i));
-            int current_idx = 0;
-            while (current_idx < n_levels &&
-              strncmp(current_level, ss->level_names[param_j][current_idx], strlen(current_level)) != 0)
-            {
-                current_idx++;
-            }
-            // Sample from other levels using shift trick
-            int new_idx = random_int(0, n_levels - 2);
+            int current_idx = cfg->ints[param_j][row_i];
+            int new_idx = random_int(rng, 0, n_levels - 2);
             if (new_idx >= current_idx) new_idx++;
-            SET_STRING_ELT(s_neigh_col, row_i, mkChar(ss->level_names[param_j][new_idx]));
+            cfg->ints[param_j][row_i] = new_idx;
         }
     } else if (param_class == 3) { // ParamLgl
         // flip the value
-        LOGICAL(s_neigh_col)[row_i] ^= 1;
+        bit_set(cfg->lgl[param_j], row_i, !bit_get(cfg->lgl[param_j], row_i));
     }
 }
 
-// Set a single element of a config (in a DT) to a random value
-void dt_set_random(SEXP s_dt, int row_i, int param_j, const SearchSpace* ss) {
+// Set a single element of a config to a random value
+void cfg_set_random(Configs *cfg, int row_i, int param_j, const SearchSpace* ss, Rng *rng) {
   int param_class = ss->param_classes[param_j];
-  SEXP s_col = VECTOR_ELT(s_dt, param_j);
   if (param_class == 0) { // ParamDbl
-    REAL(s_col)[row_i] = runif(ss->lower[param_j], ss->upper[param_j]);
+    cfg->dbl[param_j][row_i] = random_unif(rng, ss->lower[param_j], ss->upper[param_j]);
   } else if (param_class == 1) { // ParamInt
-    INTEGER(s_col)[row_i] = random_int(ss->lower[param_j], ss->upper[param_j]);
+    cfg->ints[param_j][row_i] = random_int(rng, ss->lower[param_j], ss->upper[param_j]);
   } else if (param_class == 2) {    // ParamFct
-      int lev = random_int(0, ss->n_levels[param_j] - 1);
-      SET_STRING_ELT(s_col, row_i, mkChar(ss->level_names[param_j][lev]));
+    cfg->ints[param_j][row_i] = random_int(rng, 0, ss->n_levels[param_j] - 1);
   } else if (param_class == 3) { // ParamLgl
-      LOGICAL(s_col)[row_i] = random_int(0, 1);
+    bit_set(cfg->lgl[param_j], row_i, random_int(rng, 0, 1));
   }
+  bit_set(cfg->na[param_j], row_i, 0);
+}
+
+// Find the level index of a CHARSXP for a factor param, -1 if not found.
+// We compare pointers first, as R caches CHARSXPs, and only fall back to strcmp
+int find_level_index(SEXP s_chr, int param_j, const SearchSpace *ss) {
+    int n_levels = ss->n_levels[param_j];
+    for (int k = 0; k < n_levels; k++) {
+        if (ss->level_chars[param_j][k] == s_chr) return k;
+    }
+    const char *str = CHAR(s_chr);
+    for (int k = 0; k < n_levels; k++) {
+        if (strcmp(ss->level_names[param_j][k], str) == 0) return k;
+    }
+    return -1;
+}
+
+// Read a data.table into an already allocated Configs with the same number of rows.
+// The DT cols must be in search space order.
+// We are a bit lenient with the col types, as R users will pass in doubles for ints, all-NA logicals, etc.
+void cfg_from_dt(SEXP s_dt, Configs *cfg, const SearchSpace *ss) {
+    int n = cfg->n_rows;
+    for (int j = 0; j < ss->n_params; j++) {
+        int param_class = ss->param_classes[j];
+        SEXP s_col = VECTOR_ELT(s_dt, j);
+        int col_type = TYPEOF(s_col);
+        for (int i = 0; i < n; i++) {
+            // NA handling is the same for all param classes
+            int is_na = 0;
+            if (col_type == REALSXP) {
+                is_na = ISNAN(REAL(s_col)[i]);
+            } else if (col_type == INTSXP) {
+                is_na = INTEGER(s_col)[i] == NA_INTEGER;
+            } else if (col_type == LGLSXP) {
+                is_na = LOGICAL(s_col)[i] == NA_LOGICAL;
+            } else if (col_type == STRSXP) {
+                is_na = STRING_ELT(s_col, i) == NA_STRING;
+            } else {
+                error("Column '%s' has unsupported type", ss->param_names[j]);
+            }
+            if (is_na) {
+                cfg_set_na(cfg, i, j);
+                continue;
+            }
+            bit_set(cfg->na[j], i, 0);
+            if (param_class == 0 && col_type == REALSXP) { // ParamDbl
+                cfg->dbl[j][i] = REAL(s_col)[i];
+            } else if (param_class == 0 && col_type == INTSXP) {
+                cfg->dbl[j][i] = (double) INTEGER(s_col)[i];
+            } else if (param_class == 1 && col_type == INTSXP) { // ParamInt
+                cfg->ints[j][i] = INTEGER(s_col)[i];
+            } else if (param_class == 1 && col_type == REALSXP) {
+                cfg->ints[j][i] = (int) round(REAL(s_col)[i]);
+            } else if (param_class == 2 && col_type == STRSXP) { // ParamFct
+                int k = find_level_index(STRING_ELT(s_col, i), j, ss);
+                if (k < 0) {
+                    error("Value '%s' is not a level of parameter '%s'", CHAR(STRING_ELT(s_col, i)), ss->param_names[j]);
+                }
+                cfg->ints[j][i] = k;
+            } else if (param_class == 3 && col_type == LGLSXP) { // ParamLgl
+                bit_set(cfg->lgl[j], i, LOGICAL(s_col)[i] != 0);
+            } else {
+                error("Column '%s' has wrong type for its parameter class", ss->param_names[j]);
+            }
+        }
+    }
+}
+
+// Write configs into an existing data.table, created by dt_generate (or with the same col types).
+// Row rows[i] of cfg is written to row i of the DT, for i < n; if rows is NULL we write rows 0..n-1.
+// Factor values are written as the cached level CHARSXPs, so we never call mkChar here.
+void cfg_to_dt(const Configs *cfg, const int *rows, int n, SEXP s_dt, const SearchSpace *ss) {
+    for (int j = 0; j < ss->n_params; j++) {
+        int param_class = ss->param_classes[j];
+        SEXP s_col = VECTOR_ELT(s_dt, j);
+        const uint64_t *na = cfg->na[j];
+        if (param_class == 0) { // ParamDbl
+            if (TYPEOF(s_col) != REALSXP) error("Column '%s' must be double", ss->param_names[j]);
+            double *col = REAL(s_col);
+            for (int i = 0; i < n; i++) {
+                int r = rows == NULL ? i : rows[i];
+                col[i] = bit_get(na, r) ? NA_REAL : cfg->dbl[j][r];
+            }
+        } else if (param_class == 1) { // ParamInt
+            if (TYPEOF(s_col) != INTSXP) error("Column '%s' must be integer", ss->param_names[j]);
+            int *col = INTEGER(s_col);
+            for (int i = 0; i < n; i++) {
+                int r = rows == NULL ? i : rows[i];
+                col[i] = bit_get(na, r) ? NA_INTEGER : cfg->ints[j][r];
+            }
+        } else if (param_class == 2) { // ParamFct
+            if (TYPEOF(s_col) != STRSXP) error("Column '%s' must be character", ss->param_names[j]);
+            for (int i = 0; i < n; i++) {
+                int r = rows == NULL ? i : rows[i];
+                SET_STRING_ELT(s_col, i, bit_get(na, r) ? NA_STRING : ss->level_chars[j][cfg->ints[j][r]]);
+            }
+        } else { // ParamLgl
+            if (TYPEOF(s_col) != LGLSXP) error("Column '%s' must be logical", ss->param_names[j]);
+            int *col = LOGICAL(s_col);
+            for (int i = 0; i < n; i++) {
+                int r = rows == NULL ? i : rows[i];
+                col[i] = bit_get(na, r) ? NA_LOGICAL : bit_get(cfg->lgl[j], r);
+            }
+        }
+    }
+}
+
+// Convert a single config row to a named list of scalars, NA elements become typed NA scalars
+// Returned SEXP must be protected by the caller
+SEXP cfg_row_to_list(const Configs *cfg, int row_i, const SearchSpace *ss) {
+    SEXP s_res = PROTECT(RC_named_list_create(ss->n_params, ss->param_names));
+    for (int j = 0; j < ss->n_params; j++) {
+        int param_class = ss->param_classes[j];
+        int is_na = cfg_is_na(cfg, row_i, j);
+        if (param_class == 0) { // ParamDbl
+            SET_VECTOR_ELT(s_res, j, ScalarReal(is_na ? NA_REAL : cfg->dbl[j][row_i]));
+        } else if (param_class == 1) { // ParamInt
+            SET_VECTOR_ELT(s_res, j, ScalarInteger(is_na ? NA_INTEGER : cfg->ints[j][row_i]));
+        } else if (param_class == 2) { // ParamFct
+            SET_VECTOR_ELT(s_res, j, ScalarString(is_na ? NA_STRING : ss->level_chars[j][cfg->ints[j][row_i]]));
+        } else { // ParamLgl
+            SET_VECTOR_ELT(s_res, j, ScalarLogical(is_na ? NA_LOGICAL : bit_get(cfg->lgl[j], row_i)));
+        }
+    }
+    UNPROTECT(1); // s_res
+    return s_res;
+}
+
+
+/************ Cache functions ********** */
+
+// Hash of the canonical encoding of a config row, NA bits included.
+// NA value slots are zeroed, so equal configs always have equal hashes.
+uint64_t cfg_hash_row(const Configs *cfg, int row_i, const SearchSpace *ss) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (int j = 0; j < ss->n_params; j++) {
+        int param_class = ss->param_classes[j];
+        uint64_t v;
+        if (param_class == 0) { // ParamDbl
+            double d = cfg->dbl[j][row_i] + 0.0; // maps -0.0 to 0.0, they compare equal
+            memcpy(&v, &d, sizeof(double));
+        } else if (param_class == 1 || param_class == 2) { // ParamInt, ParamFct
+            v = (uint64_t) (uint32_t) cfg->ints[j][row_i];
+        } else { // ParamLgl
+            v = (uint64_t) bit_get(cfg->lgl[j], row_i);
+        }
+        h = mix64(h ^ v) + (uint64_t) bit_get(cfg->na[j], row_i);
+    }
+    return mix64(h);
+}
+
+// Check if row a_i of a and row b_i of b are the same config
+int cfg_rows_equal(const Configs *a, int a_i, const Configs *b, int b_i, const SearchSpace *ss) {
+    for (int j = 0; j < ss->n_params; j++) {
+        int param_class = ss->param_classes[j];
+        if (bit_get(a->na[j], a_i) != bit_get(b->na[j], b_i)) return 0;
+        if (param_class == 0) { // ParamDbl
+            if (a->dbl[j][a_i] != b->dbl[j][b_i]) return 0;
+        } else if (param_class == 1 || param_class == 2) { // ParamInt, ParamFct
+            if (a->ints[j][a_i] != b->ints[j][b_i]) return 0;
+        } else { // ParamLgl
+            if (bit_get(a->lgl[j], a_i) != bit_get(b->lgl[j], b_i)) return 0;
+        }
+    }
+    return 1;
+}
+
+// (re)allocate the hash table with n_slots slots and insert all entries again
+static void cache_rehash(Cache *cache, int n_slots) {
+    cache->n_slots = n_slots;
+    cache->slots = (int*) R_alloc(n_slots, sizeof(int));
+    for (int s = 0; s < n_slots; s++) cache->slots[s] = -1;
+    for (int k = 0; k < cache->n; k++) {
+        int s = (int) (cache->hashes[k] & (uint64_t) (n_slots - 1));
+        while (cache->slots[s] != -1) s = (s + 1) & (n_slots - 1);
+        cache->slots[s] = k;
+    }
+}
+
+// Allocate an empty cache for at least `capacity` entries,
+// batch_size is the max number of neighbors we evaluate in one objective call
+void cache_init(Cache *cache, int capacity, int batch_size, const SearchSpace *ss) {
+    int cap = 64;
+    while (cap < capacity) cap *= 2;
+    cfg_alloc(&cache->x, cap, ss);
+    cache->y = (double*) R_alloc(cap, sizeof(double));
+    cache->hashes = (uint64_t*) R_alloc(cap, sizeof(uint64_t));
+    cache->last_visit = (int*) R_alloc(cap, sizeof(int));
+    cache->n = 0;
+    cache_rehash(cache, 2 * cap);
+    cache->entry_idx = (int*) R_alloc(batch_size, sizeof(int));
+    cache->miss_rows = (int*) R_alloc(batch_size, sizeof(int));
+    cache->miss_y = (double*) R_alloc(batch_size, sizeof(double));
+    cfg_alloc(&cache->miss_x, batch_size, ss);
+}
+
+// double the capacity, the old memory is released at the end of the .Call
+static void cache_grow(Cache *cache, const SearchSpace *ss) {
+    int cap = cache->x.n_rows * 2;
+    Configs x;
+    cfg_alloc(&x, cap, ss);
+    for (int k = 0; k < cache->n; k++) {
+        cfg_copy_row(&x, k, &cache->x, k, ss);
+    }
+    cache->x = x;
+    double *y = (double*) R_alloc(cap, sizeof(double));
+    uint64_t *hashes = (uint64_t*) R_alloc(cap, sizeof(uint64_t));
+    int *last_visit = (int*) R_alloc(cap, sizeof(int));
+    memcpy(y, cache->y, cache->n * sizeof(double));
+    memcpy(hashes, cache->hashes, cache->n * sizeof(uint64_t));
+    memcpy(last_visit, cache->last_visit, cache->n * sizeof(int));
+    cache->y = y;
+    cache->hashes = hashes;
+    cache->last_visit = last_visit;
+    cache_rehash(cache, 2 * cap);
+}
+
+// Find the entry of a config, returns -1 if it is not in the cache
+int cache_find(const Cache *cache, const Configs *cfg, int row_i, uint64_t hash, const SearchSpace *ss) {
+    int mask = cache->n_slots - 1;
+    for (int s = (int) (hash & (uint64_t) mask); cache->slots[s] != -1; s = (s + 1) & mask) {
+        int k = cache->slots[s];
+        if (cache->hashes[k] == hash && cfg_rows_equal(&cache->x, k, cfg, row_i, ss)) return k;
+    }
+    return -1;
+}
+
+// Insert a config which is not in the cache yet, returns its entry
+int cache_insert(Cache *cache, const Configs *cfg, int row_i, uint64_t hash, double y, const SearchSpace *ss) {
+    if (cache->n == cache->x.n_rows) cache_grow(cache, ss);
+    int k = cache->n++;
+    cfg_copy_row(&cache->x, k, cfg, row_i, ss);
+    cache->y[k] = y;
+    cache->hashes[k] = hash;
+    cache->last_visit[k] = -1;
+    int mask = cache->n_slots - 1;
+    int s = (int) (hash & (uint64_t) mask);
+    while (cache->slots[s] != -1) s = (s + 1) & mask;
+    cache->slots[s] = k;
+    return k;
+}
+
+// Record the step for all searches that moved in this step (their stagnate count was reset).
+// The new points are always in the cache, as they were evaluated as neighbors.
+void cache_mark_visited(Cache *cache, const Configs *pop_x, const int *stagnate_count, int step, const SearchSpace *ss) {
+    for (int i = 0; i < pop_x->n_rows; i++) {
+        if (stagnate_count[i] != 0) continue;
+        int k = cache_find(cache, pop_x, i, cfg_hash_row(pop_x, i, ss), ss);
+        if (k >= 0) cache->last_visit[k] = step;
+    }
+}
+
+
+/************ Top-k functions ********** */
+
+// Gower distance of two config rows: mean over all params of the absolute difference in [0, 1] scaled
+// values for numeric params and of 0/1 (equal / not equal) for factors and logicals.
+// A param that is NA in exactly one of the rows has distance 1, in both rows 0.
+double cfg_dist(const Configs *a, int a_i, const Configs *b, int b_i, const SearchSpace *ss) {
+    double d = 0;
+    for (int j = 0; j < ss->n_params; j++) {
+        int param_class = ss->param_classes[j];
+        int a_na = bit_get(a->na[j], a_i), b_na = bit_get(b->na[j], b_i);
+        if (a_na || b_na) {
+            d += a_na != b_na;
+        } else if (param_class == 0 || param_class == 1) { // ParamDbl, ParamInt
+            double range = ss->upper[j] - ss->lower[j];
+            double diff = param_class == 0 ?
+                a->dbl[j][a_i] - b->dbl[j][b_i] : (double) a->ints[j][a_i] - b->ints[j][b_i];
+            if (range > 0) d += fabs(diff) / range;
+        } else if (param_class == 2) { // ParamFct
+            d += a->ints[j][a_i] != b->ints[j][b_i];
+        } else { // ParamLgl
+            d += bit_get(a->lgl[j], a_i) != bit_get(b->lgl[j], b_i);
+        }
+    }
+    return d / ss->n_params;
+}
+
+void topk_init(TopK *topk, int k, double min_dist, const SearchSpace *ss) {
+    cfg_alloc(&topk->x, k, ss);
+    topk->y = (double*) R_alloc(k, sizeof(double));
+    topk->heap = (int*) R_alloc(k, sizeof(int));
+    topk->pos = (int*) R_alloc(k, sizeof(int));
+    topk->conflicts = (int*) R_alloc(k, sizeof(int));
+    for (int s = 0; s < k; s++) {
+        topk->heap[s] = s;
+        topk->pos[s] = s;
+    }
+    topk->n = 0;
+    topk->k = k;
+    topk->min_dist = min_dist;
+}
+
+static void topk_swap(TopK *topk, int p, int q) {
+    int s = topk->heap[p];
+    topk->heap[p] = topk->heap[q];
+    topk->heap[q] = s;
+    topk->pos[topk->heap[p]] = p;
+    topk->pos[topk->heap[q]] = q;
+}
+
+// restore the heap order for position p, after the y of its slot changed
+static void topk_sift(TopK *topk, int p) {
+    const double *y = topk->y;
+    while (p > 0 && y[topk->heap[p]] > y[topk->heap[(p - 1) / 2]]) {
+        topk_swap(topk, p, (p - 1) / 2);
+        p = (p - 1) / 2;
+    }
+    while (1) {
+        int largest = p, l = 2 * p + 1, r = 2 * p + 2;
+        if (l < topk->n && y[topk->heap[l]] > y[topk->heap[largest]]) largest = l;
+        if (r < topk->n && y[topk->heap[r]] > y[topk->heap[largest]]) largest = r;
+        if (largest == p) break;
+        topk_swap(topk, p, largest);
+        p = largest;
+    }
+}
+
+// remove the config at heap position p, its slot becomes free
+static void topk_remove(TopK *topk, int p) {
+    topk->n--;
+    if (p == topk->n) return;
+    topk_swap(topk, p, topk->n);
+    topk_sift(topk, p);
+}
+
+// Offer an evaluated config.
+// It is rejected if it is not better than the worst kept config of a full set, or if a kept config that is equal or
+// closer than min_dist is at least as good. Otherwise it replaces all kept configs that are too close, and the worst
+// kept config if the set is full. This is a greedy filter, a removed config is not reconsidered later.
+void topk_offer(TopK *topk, const Configs *cfg, int row_i, double y, const SearchSpace *ss) {
+    if (!(y < R_PosInf)) return; // NaN, or +Inf for tabu neighbors
+    if (topk->n == topk->k && !(y < topk->y[topk->heap[0]])) return;
+
+    int n_conflicts = 0;
+    for (int p = 0; p < topk->n; p++) {
+        int s = topk->heap[p];
+        if (cfg_rows_equal(&topk->x, s, cfg, row_i, ss) ||
+          (topk->min_dist > 0 && cfg_dist(&topk->x, s, cfg, row_i, ss) < topk->min_dist)) {
+            if (topk->y[s] <= y) return;
+            topk->conflicts[n_conflicts++] = s;
+        }
+    }
+    for (int c = 0; c < n_conflicts; c++) {
+        topk_remove(topk, topk->pos[topk->conflicts[c]]);
+    }
+
+    // take a free slot, or the one of the worst config
+    int p = topk->n < topk->k ? topk->n++ : 0;
+    int s = topk->heap[p];
+    cfg_copy_row(&topk->x, s, cfg, row_i, ss);
+    topk->y[s] = y;
+    topk_sift(topk, p);
+}
+
+// Kept configs as data.table, sorted from best to worst, with an additional column "y" on the original scale
+// Returned SEXP must be protected by the caller
+SEXP topk_to_dt(const TopK *topk, const SearchSpace *ss, const Control *ctrl) {
+    int n = topk->n;
+    // insertion sort of the slots by y, k is small
+    int *rows = (int*) R_alloc(n > 0 ? n : 1, sizeof(int));
+    for (int i = 0; i < n; i++) {
+        int s = topk->heap[i];
+        int p = i;
+        while (p > 0 && topk->y[rows[p - 1]] > topk->y[s]) {
+            rows[p] = rows[p - 1];
+            p--;
+        }
+        rows[p] = s;
+    }
+
+    SEXP s_x = PROTECT(dt_generate(n, ss));
+    cfg_to_dt(&topk->x, rows, n, s_x, ss);
+    // same DT with y as last column
+    SEXP s_dt = PROTECT(allocVector(VECSXP, ss->n_params + 1));
+    SEXP s_names = PROTECT(allocVector(STRSXP, ss->n_params + 1));
+    SEXP s_x_names = getAttrib(s_x, R_NamesSymbol);
+    for (int j = 0; j < ss->n_params; j++) {
+        SET_VECTOR_ELT(s_dt, j, VECTOR_ELT(s_x, j));
+        SET_STRING_ELT(s_names, j, STRING_ELT(s_x_names, j));
+    }
+    SEXP s_y = PROTECT(allocVector(REALSXP, n));
+    for (int i = 0; i < n; i++) {
+        REAL(s_y)[i] = topk->y[rows[i]] * ctrl->obj_mult;
+    }
+    SET_VECTOR_ELT(s_dt, ss->n_params, s_y);
+    SET_STRING_ELT(s_names, ss->n_params, mkChar("y"));
+    setAttrib(s_dt, R_NamesSymbol, s_names);
+    setAttrib(s_dt, R_ClassSymbol, getAttrib(s_x, R_ClassSymbol));
+    setAttrib(s_dt, R_RowNamesSymbol, getAttrib(s_x, R_RowNamesSymbol));
+    setAttrib(s_dt, Rf_install(".internal.selfref"), getAttrib(s_x, Rf_install(".internal.selfref")));
+    UNPROTECT(4); // s_x, s_dt, s_names, s_y
+    return s_dt;
 }
 
 
@@ -273,6 +691,7 @@ SEXP try_eval(void *data) {
 // internal function to handle what happens in the catch block
 // if the terminator triggers, we return NIL, otherwise we raise error back to R
 SEXP catch_condition(SEXP s_condition, void *data) {
+    (void) data;
     DEBUG_PRINT("Caught R condition of class: %s\n",
         CHAR(STRING_ELT(Rf_getAttrib(s_condition, R_ClassSymbol), 0)));
     if (!Rf_inherits(s_condition, "terminator_exception")) {
@@ -302,10 +721,70 @@ int find_param_index(const char* param_name, const SearchSpace* ss) {
     return -1; // Parameter not found
 }
 
+// convert the RHS of a condition to the C layout of its parent param
+// RHS values which the parent can never take (e.g. an unknown level) are stored as NA and never match
+void extract_cond_rhs(Cond *cond, const SearchSpace* ss) {
+    SEXP s_rhs = cond->s_rhs;
+    int parent_class = ss->param_classes[cond->parent_index];
+    cond->n_rhs = length(s_rhs);
+    cond->rhs_values = (double*) R_alloc(cond->n_rhs, sizeof(double));
+    for (int k = 0; k < cond->n_rhs; k++) {
+        double value = NA_REAL;
+        if (parent_class == 2 && TYPEOF(s_rhs) == STRSXP) { // ParamFct, store level index
+            int idx = find_level_index(STRING_ELT(s_rhs, k), cond->parent_index, ss);
+            if (idx >= 0) value = idx;
+        } else if (TYPEOF(s_rhs) == REALSXP) {
+            value = REAL(s_rhs)[k];
+        } else if (TYPEOF(s_rhs) == INTSXP) {
+            if (INTEGER(s_rhs)[k] != NA_INTEGER) value = INTEGER(s_rhs)[k];
+        } else if (TYPEOF(s_rhs) == LGLSXP) {
+            if (LOGICAL(s_rhs)[k] != NA_LOGICAL) value = LOGICAL(s_rhs)[k];
+        }
+        cond->rhs_values[k] = value;
+    }
+
+    // typed RHS sets, so checking a condition is a bit test or a binary search
+    cond->rhs_ints = NULL;
+    cond->n_rhs_ints = 0;
+    cond->rhs_bits = NULL;
+    if (parent_class == 1) { // ParamInt, sorted unique integral values
+        cond->rhs_ints = (int*) R_alloc(cond->n_rhs, sizeof(int));
+        for (int k = 0; k < cond->n_rhs; k++) {
+            double value = cond->rhs_values[k];
+            if (!ISNAN(value) && value == floor(value)) cond->rhs_ints[cond->n_rhs_ints++] = (int) value;
+        }
+        R_isort(cond->rhs_ints, cond->n_rhs_ints);
+        int n_unique = 0;
+        for (int k = 0; k < cond->n_rhs_ints; k++) {
+            if (n_unique == 0 || cond->rhs_ints[k] != cond->rhs_ints[n_unique - 1]) {
+                cond->rhs_ints[n_unique++] = cond->rhs_ints[k];
+            }
+        }
+        cond->n_rhs_ints = n_unique;
+    } else if (parent_class == 2 || parent_class == 3) { // ParamFct, ParamLgl, bitset over level index / 0-1
+        int n_bits = parent_class == 2 ? ss->n_levels[cond->parent_index] : 2;
+        int n_words = (n_bits + 63) / 64;
+        cond->rhs_bits = (uint64_t*) R_alloc(n_words, sizeof(uint64_t));
+        memset(cond->rhs_bits, 0, n_words * sizeof(uint64_t));
+        for (int k = 0; k < cond->n_rhs; k++) {
+            double value = cond->rhs_values[k];
+            if (!ISNAN(value) && value >= 0 && value < n_bits) bit_set(cond->rhs_bits, (int) value, 1);
+        }
+    }
+}
+
 // convert paradox SearchSpace to C SearchSpace
 void extract_ss_info(SEXP s_ss, SearchSpace* ss) {
-    ss->n_params = asInteger(RC_get_r6_el_by_name(s_ss, "length"));
     SEXP s_data = PROTECT(RC_get_r6_el_by_name(s_ss, "data"));
+    SEXP s_deps = PROTECT(RC_get_r6_el_by_name(s_ss, "deps"));
+    extract_ss_info_dt(s_data, s_deps, ss);
+    UNPROTECT(2); // s_data, s_deps
+}
+
+// convert the $data and $deps tables of a paradox SearchSpace to C SearchSpace
+// the C SearchSpace points into both tables, so they must stay alive as long as it is used
+void extract_ss_info_dt(SEXP s_data, SEXP s_deps, SearchSpace* ss) {
+    ss->n_params = length(RC_get_dt_col_by_name(s_data, "id"));
 
     // copy lower and upper bounds
     ss->lower = (double*) R_alloc(ss->n_params, sizeof(double));
@@ -352,24 +831,27 @@ void extract_ss_info(SEXP s_ss, SearchSpace* ss) {
         ss->param_names[i] = CHAR(STRING_ELT(s_ids, i));
     }
 
-    // copy level_names (just store pointers to R's string pool)
+    // copy level_names and level_chars (just store pointers to R's string pool)
     ss->level_names = (const char***) R_alloc(ss->n_params, sizeof(char**));
+    ss->level_chars = (SEXP**) R_alloc(ss->n_params, sizeof(SEXP*));
     SEXP s_ps_levels = RC_get_dt_col_by_name(s_data, "levels");
     for (int i = 0; i < ss->n_params; i++) {
         if (ss->param_classes[i] == 2 ) { // ParamFct
             SEXP s_p_levels = VECTOR_ELT(s_ps_levels, i);
             int n_levels = ss->n_levels[i];
             ss->level_names[i] = (const char**) R_alloc(n_levels, sizeof(char*));
+            ss->level_chars[i] = (SEXP*) R_alloc(n_levels, sizeof(SEXP));
             for (int k = 0; k < n_levels; k++) {
-                ss->level_names[i][k] = CHAR(STRING_ELT(s_p_levels, k));
+                ss->level_chars[i][k] = STRING_ELT(s_p_levels, k);
+                ss->level_names[i][k] = CHAR(ss->level_chars[i][k]);
             }
         } else {
             ss->level_names[i] = NULL;
+            ss->level_chars[i] = NULL;
         }
     }
 
     DEBUG_PRINT("extracting conditions\n");
-    SEXP s_deps = PROTECT(RC_get_r6_el_by_name(s_ss, "deps"));
     SEXP s_deps_on = PROTECT(RC_get_dt_col_by_name(s_deps, "on"));
     SEXP s_deps_id = PROTECT(RC_get_dt_col_by_name(s_deps, "id"));
     DEBUG_PRINT("s_deps_id type: %d\n", TYPEOF(s_deps_id));
@@ -387,12 +869,13 @@ void extract_ss_info(SEXP s_ss, SearchSpace* ss) {
         SEXP s_cond = VECTOR_ELT(s_deps_cond, i);
         conds[i].type = Rf_inherits(s_cond, "CondEqual") ? 0 : 1; // 0=CondEqual, 1=CondAnyOf
         conds[i].s_rhs = RC_get_list_el_by_name(s_cond, "rhs");
+        extract_cond_rhs(&conds[i], ss);
         DEBUG_PRINT("cond %d: param_index %d, parent_index %d, type %d, rhs type %d\n",
             i, conds[i].param_index, conds[i].parent_index, conds[i].type, TYPEOF(conds[i].s_rhs));
       }
     }
     ss->conds = conds;
-    UNPROTECT(5); // s_data, s_deps, s_deps_on, s_deps_id, s_deps_cond
+    UNPROTECT(3); // s_deps_on, s_deps_id, s_deps_cond
 }
 
 void extract_ctrl_info(SEXP s_ctrl, Control* ctrl) {
@@ -403,10 +886,147 @@ void extract_ctrl_info(SEXP s_ctrl, Control* ctrl) {
     ctrl->n_neighs = asInteger(RC_get_list_el_by_name(s_ctrl, "n_neighs"));
     ctrl->mut_sd = asReal(RC_get_list_el_by_name(s_ctrl, "mut_sd"));
     ctrl->stagnate_max = asInteger(RC_get_list_el_by_name(s_ctrl, "stagnate_max"));
+    SEXP s_n_threads = RC_get_list_el_by_name(s_ctrl, "n_threads");
+    ctrl->n_threads = Rf_isNull(s_n_threads) ? 1 : asInteger(s_n_threads);
+    SEXP s_cache = RC_get_list_el_by_name(s_ctrl, "cache");
+    ctrl->cache = Rf_isNull(s_cache) ? 0 : asLogical(s_cache);
+    SEXP s_tabu_size = RC_get_list_el_by_name(s_ctrl, "tabu_size");
+    ctrl->tabu_size = Rf_isNull(s_tabu_size) ? 0 : asInteger(s_tabu_size);
+    SEXP s_strategy = RC_get_list_el_by_name(s_ctrl, "strategy");
+    ctrl->first_improvement = !Rf_isNull(s_strategy) && strcmp(CHAR(STRING_ELT(s_strategy, 0)), "first") == 0;
+    // no chunk size means the complete neighborhood is one chunk
+    SEXP s_chunk_size = RC_get_list_el_by_name(s_ctrl, "chunk_size");
+    ctrl->chunk_size = Rf_isNull(s_chunk_size) ? ctrl->n_neighs : asInteger(s_chunk_size);
+    if (ctrl->chunk_size > ctrl->n_neighs) ctrl->chunk_size = ctrl->n_neighs;
+    SEXP s_top_k = RC_get_list_el_by_name(s_ctrl, "top_k");
+    ctrl->top_k = Rf_isNull(s_top_k) ? 0 : asInteger(s_top_k);
+    SEXP s_min_dist = RC_get_list_el_by_name(s_ctrl, "min_dist");
+    ctrl->min_dist = Rf_isNull(s_min_dist) ? 0 : asReal(s_min_dist);
+    SEXP s_instrument = RC_get_list_el_by_name(s_ctrl, "instrument");
+    ctrl->instrument = Rf_isNull(s_instrument) ? 0 : asLogical(s_instrument);
     assert(ctrl->n_searches > 0);
     assert(ctrl->n_steps >= 0);
     assert(ctrl->n_neighs > 0);
     assert(ctrl->mut_sd > 0);
+    assert(ctrl->n_threads > 0);
+    assert(ctrl->tabu_size >= 0);
+    assert(ctrl->cache || ctrl->tabu_size == 0);
+    assert(ctrl->chunk_size > 0);
+    assert(ctrl->top_k >= 0);
+    assert(ctrl->min_dist >= 0);
+}
+
+
+/************ Compiled search space ********** */
+
+// A compiled search space lives in an external pointer, so it can be reused over many local_search calls.
+// All arrays are copied from R_alloc memory into malloc blocks, which are freed by the finalizer.
+// The param names, level names and condition RHS point into R objects, these are kept alive
+// through the protected field of the external pointer.
+typedef struct {
+    SearchSpace ss;
+    void **blocks;
+    int n_blocks;
+    int max_blocks;
+} SearchSpaceHandle;
+
+// copy n bytes into a new malloc block owned by the handle, NULL stays NULL
+static void* handle_copy(SearchSpaceHandle *h, const void *src, size_t n) {
+    if (src == NULL) return NULL;
+    if (h->n_blocks == h->max_blocks) {
+        int max_blocks = h->max_blocks == 0 ? 64 : 2 * h->max_blocks;
+        void **blocks = (void**) realloc(h->blocks, max_blocks * sizeof(void*));
+        if (blocks == NULL) error("Could not allocate memory for compiled search space");
+        h->blocks = blocks;
+        h->max_blocks = max_blocks;
+    }
+    void *dst = malloc(n > 0 ? n : 1);
+    if (dst == NULL) error("Could not allocate memory for compiled search space");
+    memcpy(dst, src, n);
+    h->blocks[h->n_blocks++] = dst;
+    return dst;
+}
+
+static void handle_free(SearchSpaceHandle *h) {
+    for (int b = 0; b < h->n_blocks; b++) free(h->blocks[b]);
+    free(h->blocks);
+    free(h);
+}
+
+static void search_space_finalizer(SEXP s_ptr) {
+    SearchSpaceHandle *h = (SearchSpaceHandle*) R_ExternalPtrAddr(s_ptr);
+    if (h == NULL) return;
+    handle_free(h);
+    R_ClearExternalPtr(s_ptr);
+}
+
+// deep copy of a (sorted) search space into the handle
+static void handle_copy_ss(SearchSpaceHandle *h, const SearchSpace *src) {
+    int n = src->n_params;
+    SearchSpace *ss = &h->ss;
+    *ss = *src;
+    ss->param_classes = (int*) handle_copy(h, src->param_classes, n * sizeof(int));
+    ss->lower = (double*) handle_copy(h, src->lower, n * sizeof(double));
+    ss->upper = (double*) handle_copy(h, src->upper, n * sizeof(double));
+    ss->n_levels = (int*) handle_copy(h, src->n_levels, n * sizeof(int));
+    ss->param_names = (const char**) handle_copy(h, src->param_names, n * sizeof(char*));
+    ss->level_names = (const char***) handle_copy(h, src->level_names, n * sizeof(char**));
+    ss->level_chars = (SEXP**) handle_copy(h, src->level_chars, n * sizeof(SEXP*));
+    for (int j = 0; j < n; j++) {
+        ss->level_names[j] = (const char**) handle_copy(h, src->level_names[j], src->n_levels[j] * sizeof(char*));
+        ss->level_chars[j] = (SEXP*) handle_copy(h, src->level_chars[j], src->n_levels[j] * sizeof(SEXP));
+    }
+    ss->conds = (Cond*) handle_copy(h, src->conds, src->n_conds * sizeof(Cond));
+    for (int c = 0; c < src->n_conds; c++) {
+        const Cond *cond = &src->conds[c];
+        int parent_class = src->param_classes[cond->parent_index];
+        int n_bits = parent_class == 2 ? src->n_levels[cond->parent_index] : 2;
+        ss->conds[c].rhs_values = (double*) handle_copy(h, cond->rhs_values, cond->n_rhs * sizeof(double));
+        ss->conds[c].rhs_ints = (int*) handle_copy(h, cond->rhs_ints, cond->n_rhs_ints * sizeof(int));
+        ss->conds[c].rhs_bits = (uint64_t*) handle_copy(h, cond->rhs_bits, ((n_bits + 63) / 64) * sizeof(uint64_t));
+    }
+    ss->sorted_param_indices = (int*) handle_copy(h, src->sorted_param_indices, n * sizeof(int));
+    ss->cond_start = (int*) handle_copy(h, src->cond_start, n * sizeof(int));
+    ss->cond_end = (int*) handle_copy(h, src->cond_end, n * sizeof(int));
+    ss->desc_start = (int*) handle_copy(h, src->desc_start, (n + 1) * sizeof(int));
+    ss->desc = (int*) handle_copy(h, src->desc, src->desc_start[n] * sizeof(int));
+}
+
+// Compile a paradox ParamSet into an external pointer, which can be passed instead of the ParamSet
+// to c_local_search. The external pointer protects the ParamSet data the compiled struct points into.
+SEXP c_local_search_compile(SEXP s_ss) {
+    // keep the R objects alive that param names, level names and the cond RHS point into
+    SEXP s_prot = PROTECT(allocVector(VECSXP, 2));
+    SET_VECTOR_ELT(s_prot, 0, RC_get_r6_el_by_name(s_ss, "data"));
+    SET_VECTOR_ELT(s_prot, 1, RC_get_r6_el_by_name(s_ss, "deps"));
+    SearchSpace ss;
+    extract_ss_info_dt(VECTOR_ELT(s_prot, 0), VECTOR_ELT(s_prot, 1), &ss);
+    toposort_params(&ss);
+    reorder_conds_by_toposort(&ss);
+
+    SearchSpaceHandle *h = (SearchSpaceHandle*) calloc(1, sizeof(SearchSpaceHandle));
+    if (h == NULL) error("Could not allocate memory for compiled search space");
+    SEXP s_ptr = PROTECT(R_MakeExternalPtr(h, Rf_install("bbotk_search_space"), s_prot));
+    R_RegisterCFinalizerEx(s_ptr, search_space_finalizer, TRUE);
+    // the finalizer frees all blocks copied so far if we run into an error
+    handle_copy_ss(h, &ss);
+    UNPROTECT(2); // s_prot, s_ptr
+    return s_ptr;
+}
+
+// Set up the search space for a local search run, either from a compiled search space (external pointer,
+// no work at all) or by extracting it from a paradox ParamSet
+void get_search_space(SEXP s_ss, SearchSpace *ss) {
+    if (TYPEOF(s_ss) == EXTPTRSXP) {
+        if (R_ExternalPtrTag(s_ss) != Rf_install("bbotk_search_space") || R_ExternalPtrAddr(s_ss) == NULL) {
+            error("Compiled search space is not valid (e.g. after saving and loading), compile it again");
+        }
+        *ss = ((SearchSpaceHandle*) R_ExternalPtrAddr(s_ss))->ss;
+        return;
+    }
+    extract_ss_info(s_ss, ss);
+    toposort_params(ss);
+    reorder_conds_by_toposort(ss);
 }
 
 
@@ -414,67 +1034,117 @@ void extract_ctrl_info(SEXP s_ctrl, Control* ctrl) {
 
 // topological sort of parameters based on dependencies
 // if param B depends on param A, then B comes after A in the sort
+// we also compute the descendants of every param, these are the params we have to repair after a mutation
 void toposort_params(SearchSpace* ss) {
-    int* sorted = (int*) R_alloc(ss->n_params, sizeof(int));
-    int* deps = (int*) R_alloc(ss->n_params, sizeof(int));
-    memset(deps, 0, ss->n_params * sizeof(int));
-    int count = 0;
-    // Count dependencies for each parameter
+    int n_params = ss->n_params;
+    int* sorted = (int*) R_alloc(n_params, sizeof(int));
+    int* deps = (int*) R_alloc(n_params, sizeof(int));
+    memset(deps, 0, n_params * sizeof(int));
+    // conds grouped by their parent (CSR), in their original order
+    int* child_start = (int*) R_alloc(n_params + 1, sizeof(int));
+    int* child_conds = (int*) R_alloc(ss->n_conds + 1, sizeof(int));
+    memset(child_start, 0, (n_params + 1) * sizeof(int));
+    // Count dependencies for each parameter, and children for each parent
     for (int i = 0; i < ss->n_conds; i++) {
         deps[ss->conds[i].param_index]++;
+        child_start[ss->conds[i].parent_index + 1]++;
     }
+    for (int j = 0; j < n_params; j++) {
+        child_start[j + 1] += child_start[j];
+    }
+    int* fill = (int*) R_alloc(n_params, sizeof(int));
+    memcpy(fill, child_start, n_params * sizeof(int));
+    for (int i = 0; i < ss->n_conds; i++) {
+        child_conds[fill[ss->conds[i].parent_index]++] = i;
+    }
+    int count = 0;
     // Add parameters with no dependencies first
-    for (int i = 0; i < ss->n_params; i++) {
+    for (int i = 0; i < n_params; i++) {
         if (deps[i] == 0) sorted[count++] = i;
     }
     // For each param in the sorted list, we decrement the deps of all params that depend on it
     // the add all params to the sorted list that have no deps left, then iterate again
     for (int i = 0; i < count; i++) {
-        for (int j = 0; j < ss->n_conds; j++) {
-            if (ss->conds[j].parent_index == sorted[i]) {
-                int dep = ss->conds[j].param_index;
-                if (--deps[dep] == 0) sorted[count++] = dep;
-            }
+        int parent = sorted[i];
+        for (int c = child_start[parent]; c < child_start[parent + 1]; c++) {
+            int dep = ss->conds[child_conds[c]].param_index;
+            if (--deps[dep] == 0) sorted[count++] = dep;
         }
     }
-    assert(count == ss->n_params);
+    assert(count == n_params);
     ss->sorted_param_indices = sorted;
+
+    // descendants of each param: mark everything reachable, then collect in topological order
+    int* topo_pos = (int*) R_alloc(n_params, sizeof(int));
+    for (int i = 0; i < n_params; i++) {
+        topo_pos[sorted[i]] = i;
+    }
+    int* mark = (int*) R_alloc(n_params, sizeof(int));
+    int* stack = (int*) R_alloc(n_params, sizeof(int));
+    ss->desc_start = (int*) R_alloc(n_params + 1, sizeof(int));
+    // first pass counts, second pass fills
+    for (int pass = 0; pass < 2; pass++) {
+        int n_desc = 0;
+        for (int j = 0; j < n_params; j++) {
+            ss->desc_start[j] = n_desc;
+            if (child_start[j] == child_start[j + 1]) continue; // no children, the common case
+            memset(mark, 0, n_params * sizeof(int));
+            int n_stack = 0;
+            stack[n_stack++] = j;
+            while (n_stack > 0) {
+                int p = stack[--n_stack];
+                for (int c = child_start[p]; c < child_start[p + 1]; c++) {
+                    int child = ss->conds[child_conds[c]].param_index;
+                    if (!mark[child]) {
+                        mark[child] = 1;
+                        stack[n_stack++] = child;
+                    }
+                }
+            }
+            for (int i = topo_pos[j] + 1; i < n_params; i++) {
+                if (mark[sorted[i]]) {
+                    if (pass == 1) ss->desc[n_desc] = sorted[i];
+                    n_desc++;
+                }
+            }
+        }
+        ss->desc_start[n_params] = n_desc;
+        if (pass == 0) ss->desc = (int*) R_alloc(n_desc + 1, sizeof(int));
+    }
 }
 
 // Reorder conditions based on topological sort
 // Conditions come in "blocks", so all conds for param A are next to each other
+// This is a stable counting sort on the topological position of the param, the block of param j
+// is stored in cond_start[j], cond_end[j]
 void reorder_conds_by_toposort(SearchSpace* ss) {
-    if (ss->n_conds <= 1) return;
-    Cond* reordered_conds = (Cond*) R_alloc(ss->n_conds, sizeof(Cond));
-    int reordered_count = 0;
-    // go thru params in topological order, collect all conds for current param
-    for (int i = 0; i < ss->n_params; i++) {
-        int param_index = ss->sorted_param_indices[i];
-        // Find all conditions for this parameter
-        for (int j = 0; j < ss->n_conds; j++) {
-            if (ss->conds[j].param_index == param_index) {
-                reordered_conds[reordered_count++] = ss->conds[j];
-            }
-        }
+    int n_params = ss->n_params;
+    int* topo_pos = (int*) R_alloc(n_params, sizeof(int));
+    for (int i = 0; i < n_params; i++) {
+        topo_pos[ss->sorted_param_indices[i]] = i;
     }
-    assert(reordered_count == ss->n_conds);
-    // copy back to original array
+    // count conds per topological position, prefix sums give the block offsets
+    int* block_start = (int*) R_alloc(n_params + 1, sizeof(int));
+    memset(block_start, 0, (n_params + 1) * sizeof(int));
     for (int i = 0; i < ss->n_conds; i++) {
-        ss->conds[i] = reordered_conds[i];
+        block_start[topo_pos[ss->conds[i].param_index] + 1]++;
     }
-}
-
-// Helper function for is_condition_satisfied to avoid repetition of code
-int is_condition_satisfied_helper(int parent_class, SEXP s_parent_col, int i, SEXP s_rhs, int k) {
-    if (parent_class == 0) { // ParamDbl
-        return fabs(REAL(s_parent_col)[i] - REAL(s_rhs)[k]) < 1e-8;
-    } else if (parent_class == 1) { // ParamInt
-        return INTEGER(s_parent_col)[i] == INTEGER(s_rhs)[k];
-    } else if (parent_class == 2) { // ParamFct
-        return strcmp(CHAR(STRING_ELT(s_parent_col, i)), CHAR(STRING_ELT(s_rhs, k))) == 0;
-    } else { // ParamLgl
-        return LOGICAL(s_parent_col)[i] == LOGICAL(s_rhs)[k];
+    for (int i = 0; i < n_params; i++) {
+        block_start[i + 1] += block_start[i];
+    }
+    ss->cond_start = (int*) R_alloc(n_params, sizeof(int));
+    ss->cond_end = (int*) R_alloc(n_params, sizeof(int));
+    for (int j = 0; j < n_params; j++) {
+        ss->cond_start[j] = block_start[topo_pos[j]];
+        ss->cond_end[j] = block_start[topo_pos[j] + 1];
     }
+    if (ss->n_conds <= 1) return;
+    Cond* reordered_conds = (Cond*) R_alloc(ss->n_conds, sizeof(Cond));
+    for (int i = 0; i < ss->n_conds; i++) {
+        reordered_conds[block_start[topo_pos[ss->conds[i].param_index]]++] = ss->conds[i];
+    }
+    // copy back to original array
+    memcpy(ss->conds, reordered_conds, ss->n_conds * sizeof(Cond));
 }
 
 // Check if a condition is satisfied for a given row
@@ -482,107 +1152,222 @@ int is_condition_satisfied_helper(int parent_class, SEXP s_parent_col, int i, SE
 // not the condition-param itself
 // if the parent parameter is NA the condition is not satisfied, as the parent is non-active
 // (i dont think we want to allow that a subordinate is only active when the super parameter is non-active)
-int is_condition_satisfied(SEXP s_neighs_x, int i, const Cond *cond, const SearchSpace* ss) {
-    SEXP s_parent_col = VECTOR_ELT(s_neighs_x, cond->parent_index);
-    int parent_class = ss->param_classes[cond->parent_index];
-    SEXP s_rhs = cond->s_rhs;
-    int is_satisfied = 0;
+// CondEqual is handled as CondAnyOf with a single RHS value
+int is_condition_satisfied(const Configs *cfg, int i, const Cond *cond, const SearchSpace* ss) {
+    int parent_j = cond->parent_index;
+    int parent_class = ss->param_classes[parent_j];
     DEBUG_PRINT("is_condition_satisfied: row %d, param %s, parent %s, parent_class %d, cond-type %d\n",
-        i, ss->param_names[cond->param_index], ss->param_names[cond->parent_index], parent_class, cond->type);
+        i, ss->param_names[cond->param_index], ss->param_names[parent_j], parent_class, cond->type);
     // if the parent parameter is NA and hence non-active, the condition is not satisfied
-    if (dt_is_na(s_neighs_x, i, cond->parent_index)) {
+    if (cfg_is_na(cfg, i, parent_j)) {
         return 0;
     }
 
-    if (cond->type == 0) { // CondEqual, check if parent value equals the RHS value
-        is_satisfied = is_condition_satisfied_helper(parent_class, s_parent_col, i, s_rhs, 0);
-    } else { // CondAnyOf, check if parent value is in the RHS values
-        int n_rhs = length(s_rhs);
-        for (int k = 0; k < n_rhs; k++) {
-            is_satisfied |= is_condition_satisfied_helper(parent_class, s_parent_col, i, s_rhs, k);
+    if (parent_class == 0) { // ParamDbl, compare with tolerance
+        double value = cfg->dbl[parent_j][i];
+        for (int k = 0; k < cond->n_rhs; k++) {
+            if (fabs(value - cond->rhs_values[k]) < 1e-8) return 1;
         }
+        return 0;
+    } else if (parent_class == 1) { // ParamInt, binary search in the sorted RHS
+        int value = cfg->ints[parent_j][i];
+        int lo = 0, hi = cond->n_rhs_ints - 1;
+        while (lo <= hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (cond->rhs_ints[mid] == value) return 1;
+            if (cond->rhs_ints[mid] < value) lo = mid + 1; else hi = mid - 1;
+        }
+        return 0;
+    } else if (parent_class == 2) { // ParamFct, level index bitset
+        return bit_get(cond->rhs_bits, cfg->ints[parent_j][i]);
+    } else { // ParamLgl
+        return bit_get(cond->rhs_bits, bit_get(cfg->lgl[parent_j], i));
     }
-    return is_satisfied;
 }
 
 
 
+/************ Instrumentation ********** */
+
+double instr_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+void instr_init(Instr *instr, int n_steps, int n_threads) {
+    instr->t_total = instr->t_restart = instr->t_generate = instr->t_eval = instr->t_select = 0;
+    instr->n_threads = n_threads;
+    size_t n_pad = (size_t) n_threads * INSTR_PAD;
+    instr->t_copy = (double*) R_alloc(n_pad, sizeof(double));
+    instr->t_mutate = (double*) R_alloc(n_pad, sizeof(double));
+    instr->t_repair = (double*) R_alloc(n_pad, sizeof(double));
+    instr->n_unmutated = (int*) R_alloc(n_pad, sizeof(int));
+    memset(instr->t_copy, 0, n_pad * sizeof(double));
+    memset(instr->t_mutate, 0, n_pad * sizeof(double));
+    memset(instr->t_repair, 0, n_pad * sizeof(double));
+    memset(instr->n_unmutated, 0, n_pad * sizeof(int));
+    instr->n_steps = 0;
+    instr->step_restarts = (int*) R_alloc(n_steps, sizeof(int));
+    instr->step_improved = (int*) R_alloc(n_steps, sizeof(int));
+    instr->step_evals = (int*) R_alloc(n_steps, sizeof(int));
+    instr->step_unmutated = (int*) R_alloc(n_steps, sizeof(int));
+    instr->step_best_y = (double*) R_alloc(n_steps, sizeof(double));
+}
+
+static int instr_sum_unmutated(const Instr *instr) {
+    int n = 0;
+    for (int t = 0; t < instr->n_threads; t++) n += instr->n_unmutated[t * INSTR_PAD];
+    return n;
+}
+
+// list(timings = named numeric, steps = list of equal length vectors), y on the original scale
+// Returned SEXP must be protected by the caller
+SEXP instr_to_list(const Instr *instr, const Control *ctrl) {
+    double t_copy = 0, t_mutate = 0, t_repair = 0;
+    for (int t = 0; t < instr->n_threads; t++) {
+        t_copy += instr->t_copy[t * INSTR_PAD];
+        t_mutate += instr->t_mutate[t * INSTR_PAD];
+        t_repair += instr->t_repair[t * INSTR_PAD];
+    }
+    const char *timing_names[] = {"total", "restart", "generate", "copy", "mutate", "repair", "eval", "select"};
+    double timings[] = {instr->t_total, instr->t_restart, instr->t_generate, t_copy, t_mutate, t_repair,
+        instr->t_eval, instr->t_select};
+    SEXP s_timings = PROTECT(allocVector(REALSXP, 8));
+    SEXP s_timing_names = PROTECT(allocVector(STRSXP, 8));
+    for (int i = 0; i < 8; i++) {
+        REAL(s_timings)[i] = timings[i];
+        SET_STRING_ELT(s_timing_names, i, mkChar(timing_names[i]));
+    }
+    setAttrib(s_timings, R_NamesSymbol, s_timing_names);
+
+    int n = instr->n_steps;
+    SEXP s_steps = PROTECT(RC_named_list_create(6, (const char*[]){"step", "n_restarts", "n_improved", "n_evals",
+        "n_unmutated", "best_y"}));
+    const int *counters[] = {instr->step_restarts, instr->step_improved, instr->step_evals, instr->step_unmutated};
+    SEXP s_step = PROTECT(allocVector(INTSXP, n));
+    for (int i = 0; i < n; i++) INTEGER(s_step)[i] = i + 1;
+    SET_VECTOR_ELT(s_steps, 0, s_step);
+    for (int c = 0; c < 4; c++) {
+        SEXP s_col = PROTECT(allocVector(INTSXP, n));
+        if (n > 0) memcpy(INTEGER(s_col), counters[c], n * sizeof(int));
+        SET_VECTOR_ELT(s_steps, c + 1, s_col);
+        UNPROTECT(1); // s_col
+    }
+    SEXP s_best_y = PROTECT(allocVector(REALSXP, n));
+    for (int i = 0; i < n; i++) REAL(s_best_y)[i] = instr->step_best_y[i] * ctrl->obj_mult;
+    SET_VECTOR_ELT(s_steps, 5, s_best_y);
+
+    SEXP s_instr = PROTECT(RC_named_list_create(2, (const char*[]){"timings", "steps"}));
+    SET_VECTOR_ELT(s_instr, 0, s_timings);
+    SET_VECTOR_ELT(s_instr, 1, s_steps);
+    UNPROTECT(6); // s_timings, s_timing_names, s_steps, s_step, s_best_y, s_instr
+    return s_instr;
+}
+
+
 /************ Local search functions ********** */
 
-// Generate neighbors for all current points in an existing data.table
-void generate_neighs(SEXP s_pop_x, SEXP s_neighs_x, const SearchSpace* ss, const Control* ctrl) {
-    DEBUG_PRINT("generate_neighs\n");
+// Generate a single neighbor: copy the current point, mutate one active param, repair the conditions
+// valid_mutable_indices is scratch memory of length n_params, instr is NULL if not used
+void generate_neigh(const Configs *pop_x, int i_pop, Configs *neighs_x, int i_neigh,
+  int *valid_mutable_indices, const SearchSpace* ss, const Control* ctrl, Rng *rng, Instr *instr, int thread_i) {
+
+    double t0 = instr != NULL ? instr_now() : 0;
+    cfg_copy_row(neighs_x, i_neigh, pop_x, i_pop, ss);
 
-    // Copy current points to neighbors -- we replicate each candidate n_neighs times
-    // we iterate over the parameters / cols first
+    // Find valid mutable parameters for this neighbor (non-NA values)
+    int n_valid_mutable = 0;
     for (int j = 0; j < ss->n_params; j++) {
-        int param_class = ss->param_classes[j];
-        SEXP s_pop_col = VECTOR_ELT(s_pop_x, j);
-        SEXP s_neigh_col = VECTOR_ELT(s_neighs_x, j);
-        for (int i_pop = 0; i_pop < ctrl->n_searches; i_pop++) {
-            for (int k = 0; k < ctrl->n_neighs; k++) {
-                int i_neigh = i_pop * ctrl->n_neighs + k;
-                if (param_class == 0) { // ParamDbl
-                    REAL(s_neigh_col)[i_neigh] = REAL(s_pop_col)[i_pop];
-                } else if (param_class == 1) { // ParamInt
-                    INTEGER(s_neigh_col)[i_neigh] = INTEGER(s_pop_col)[i_pop];
-                } else if (param_class == 2) {    // ParamFct
-                    SET_STRING_ELT(s_neigh_col, i_neigh, STRING_ELT(s_pop_col, i_pop));
-                } else { // ParamLgl
-                    LOGICAL(s_neigh_col)[i_neigh] = LOGICAL(s_pop_col)[i_pop];
-                }
-            }
+        if (!cfg_is_na(neighs_x, i_neigh, j)) {
+            valid_mutable_indices[n_valid_mutable++] = j;
         }
     }
-    DEBUG_PRINT("copied %d points to %d neighbors\n", ctrl->n_searches, ctrl->n_searches * ctrl->n_neighs);
-    dt_print(s_neighs_x, 10);
 
-    // Now mutate one parameter for each neighbor
-    for (int i_neigh = 0; i_neigh < ctrl->n_searches * ctrl->n_neighs; i_neigh++) {
-        // Find valid mutable parameters for this neighbor (non-NA values)
-        int* valid_mutable_indices = (int*) R_alloc(ss->n_params, sizeof(int));
-        int n_valid_mutable = 0;
-
-        for (int j = 0; j < ss->n_params; j++) {
-            if (!dt_is_na(s_neighs_x, i_neigh, j)) {
-                valid_mutable_indices[n_valid_mutable++] = j;
-            }
+    double t1 = instr != NULL ? instr_now() : 0;
+    if (instr != NULL) instr->t_copy[thread_i * INSTR_PAD] += t1 - t0;
+
+    // Only proceed if we have valid mutable parameters
+    if (n_valid_mutable > 0) {
+        // Select a random valid mutable parameter
+        int j = valid_mutable_indices[random_int(rng, 0, n_valid_mutable - 1)];
+
+        DEBUG_PRINT("Neighbor %d: selected parameter %d (%s) for mutation from %d valid options\n",
+            i_neigh, j, ss->param_names[j], n_valid_mutable);
+        cfg_mutate_element(neighs_x, i_neigh, j, ss, ctrl, rng);
+        DEBUG_PRINT("before checks:\n");
+        cfg_print_row(neighs_x, i_neigh, ss);
+        double t2 = instr != NULL ? instr_now() : 0;
+        // the point was valid before, so only the descendants of the mutated param can be in conflict
+        cfg_repair_descendants(neighs_x, i_neigh, j, ss, rng);
+        if (instr != NULL) {
+            instr->t_mutate[thread_i * INSTR_PAD] += t2 - t1;
+            instr->t_repair[thread_i * INSTR_PAD] += instr_now() - t2;
         }
+    } else {
+        DEBUG_PRINT("Neighbor %d: no valid mutable parameters found (all are NA)\n", i_neigh);
+        if (instr != NULL) instr->n_unmutated[thread_i * INSTR_PAD]++;
+    }
+}
 
-        // Only proceed if we have valid mutable parameters
-        if (n_valid_mutable > 0) {
-            // Select a random valid mutable parameter
-            int j = valid_mutable_indices[random_int(0, n_valid_mutable - 1)];
-
-            DEBUG_PRINT("Neighbor %d: selected parameter %d (%s) for mutation from %d valid options\n",
-                i_neigh, j, ss->param_names[j], n_valid_mutable);
-            dt_mutate_element(s_neighs_x, i_neigh, j, ss, ctrl);
-            DEBUG_PRINT("before checks:\n");
-            dt_print_row(s_neighs_x, i_neigh);
-            dt_repair_row(s_neighs_x, i_neigh, ss);
-        } else {
-            DEBUG_PRINT("Neighbor %d: no valid mutable parameters found (all are NA)\n", i_neigh);
-        }
+// Generate the neighbors k_start, ..., k_start + k_len - 1 of the searches in "searches" (all searches if NULL),
+// neighbor k of the a-th of these searches is written to row a * k_len + k of neighs_x.
+// Every neighbor draws from its own RNG stream, given by the key of the search, the step and the neighbor index,
+// so the result does not depend on the number of threads, nor on how the neighborhood is split into chunks.
+// Rows are handed out to threads in blocks of 64, so all bits of a word in the packed
+// bitmask columns are written by the same thread.
+// valid_mutable_indices is scratch memory of length n_threads * n_params, allocated once by the caller,
+// we must not call R_alloc from the worker threads, and not once per chunk either.
+void generate_neighs_chunk(const Configs *pop_x, const int *searches, int n_active, int k_start, int k_len,
+  Configs *neighs_x, int *valid_mutable_indices, const SearchSpace* ss, const Control* ctrl,
+  uint64_t key, uint64_t step, Instr *instr) {
+    DEBUG_PRINT("generate_neighs_chunk\n");
+
+    int n_neighs_chunk = n_active * k_len;
+
+#ifdef _OPENMP
+    int n_threads = ctrl->n_threads;
+    #pragma omp parallel for num_threads(n_threads) schedule(static, 64) if(n_threads > 1)
+#endif
+    for (int i_neigh = 0; i_neigh < n_neighs_chunk; i_neigh++) {
+        int thread_i = 0;
+#ifdef _OPENMP
+        thread_i = omp_get_thread_num();
+#endif
+        int a = i_neigh / k_len;
+        int pop_i = searches == NULL ? a : searches[a];
+        int k = k_start + i_neigh % k_len;
+        Rng rng = {key, rng_stream(step, (uint64_t) pop_i * ctrl->n_neighs + k), 0};
+        generate_neigh(pop_x, pop_i, neighs_x, i_neigh,
+            valid_mutable_indices + (size_t) thread_i * ss->n_params, ss, ctrl, &rng, instr, thread_i);
     }
-    DEBUG_PRINT("generate_s_neighs_x done\n");
+    DEBUG_PRINT("generated %d neighbors for %d points\n", n_neighs_chunk, n_active);
+    cfg_print(neighs_x, 10, ss);
 }
 
-// Copy the best neighbor from each block into the population
-// Also update global best-so-far when an improvement is found
-void copy_best_neighs_to_pop(SEXP s_neighs_x, double* neighs_y,
-  SEXP s_pop_x, double *pop_y, int* stagnate_count,
-  double *global_best_y, SEXP s_global_best_x,
-  const SearchSpace* ss, const Control* ctrl) {
+// Generate neighbors for all current points -- we replicate each candidate n_neighs times,
+// then mutate one parameter for each neighbor.
+void generate_neighs(const Configs *pop_x, Configs *neighs_x, const SearchSpace* ss, const Control* ctrl,
+  uint64_t key, uint64_t step) {
+    int* valid_mutable_indices = (int*) R_alloc((size_t) ctrl->n_threads * ss->n_params, sizeof(int));
+    generate_neighs_chunk(pop_x, NULL, ctrl->n_searches, 0, ctrl->n_neighs, neighs_x, valid_mutable_indices,
+        ss, ctrl, key, step, NULL);
+}
 
-    DEBUG_PRINT("copy_best_neighs_to_pop\n");
+// Keep the best neighbor of each search in a chunk as its candidate, if it is better than the candidate so far.
+// The candidates start as the current points, so only strict improvements are kept,
+// and for ties the earlier neighbor wins, no matter how the neighborhood is split into chunks.
+void update_cands(const Configs *neighs_x, const double* neighs_y, const int *searches, int n_active, int k_len,
+  Configs *cand_x, double *cand_y, const SearchSpace* ss) {
 
-    for (int pop_i = 0; pop_i < ctrl->n_searches; pop_i++) {
+    for (int a = 0; a < n_active; a++) {
+        int pop_i = searches == NULL ? a : searches[a];
         // Find the best neighbor in this block
         int best_i = -1;
-        double best_y = pop_y[pop_i];
+        double best_y = cand_y[pop_i];
 
-        for (int k = 0; k < ctrl->n_neighs; k++) {
-            int neigh_i = pop_i * ctrl->n_neighs + k;
+        for (int k = 0; k < k_len; k++) {
+            int neigh_i = a * k_len + k;
             double current_y = neighs_y[neigh_i];
 
             if (current_y < best_y) {
@@ -591,57 +1376,96 @@ void copy_best_neighs_to_pop(SEXP s_neighs_x, double* neighs_y,
             }
         }
 
-        if (best_i == -1) {
+        if (best_i != -1) {
+            DEBUG_PRINT("Best neighbor for search %d is at index %d with value %f\n", pop_i, best_i, best_y);
+            cfg_copy_row(cand_x, pop_i, neighs_x, best_i, ss);
+            cand_y[pop_i] = best_y;
+        }
+    }
+}
+
+// Move every search to its candidate if it improved, otherwise count the step as no-improvement step
+// Also update global best-so-far when an improvement is found
+// Returns the number of searches that moved
+int accept_cands(const Configs *cand_x, const double *cand_y, Configs *pop_x, double *pop_y,
+  int* stagnate_count, double *global_best_y, Configs *global_best_x, const SearchSpace* ss, const Control* ctrl) {
+
+    int n_improved = 0;
+    for (int pop_i = 0; pop_i < ctrl->n_searches; pop_i++) {
+        if (!(cand_y[pop_i] < pop_y[pop_i])) {
             DEBUG_PRINT("No better neighbor found, keep current point: %d\n", pop_i);
             stagnate_count[pop_i]++;
             continue;
-        } else {
-            // Copy the best neighbor to the population
-            DEBUG_PRINT("Best neighbor for search %d is at index %d with value %f\n", pop_i, best_i, best_y);
-            for (int j = 0; j < ss->n_params; j++) {
-                int param_class = ss->param_classes[j];
-                SEXP s_neigh_col = VECTOR_ELT(s_neighs_x, j);
-                SEXP s_pop_col = VECTOR_ELT(s_pop_x, j);
-
-                if (param_class == 0) { // ParamDbl
-                    REAL(s_pop_col)[pop_i] = REAL(s_neigh_col)[best_i];
-                } else if (param_class == 1) { // ParamInt
-                    INTEGER(s_pop_col)[pop_i] = INTEGER(s_neigh_col)[best_i];
-                } else if (param_class == 2) { // ParamFct
-                    SET_STRING_ELT(s_pop_col, pop_i, STRING_ELT(s_neigh_col, best_i));
-                } else { // ParamLgl
-                    LOGICAL(s_pop_col)[pop_i] = LOGICAL(s_neigh_col)[best_i];
-                }
-                stagnate_count[pop_i] = 0;
-            }
-            pop_y[pop_i] = best_y;
-            // Update global best if improved
-            if (best_y < *global_best_y) {
-                *global_best_y = best_y;
-                for (int j = 0; j < ss->n_params; j++) {
-                    int param_class = ss->param_classes[j];
-                    SEXP s_pop_col = VECTOR_ELT(s_pop_x, j);
-                    if (param_class == 0) { // ParamDbl
-                        SET_VECTOR_ELT(s_global_best_x, j, ScalarReal(REAL(s_pop_col)[pop_i]));
-                    } else if (param_class == 1) { // ParamInt
-                        SET_VECTOR_ELT(s_global_best_x, j, ScalarInteger(INTEGER(s_pop_col)[pop_i]));
-                    } else if (param_class == 2) { // ParamFct
-                        SET_VECTOR_ELT(s_global_best_x, j, ScalarString(STRING_ELT(s_pop_col, pop_i)));
-                    } else { // ParamLgl
-                        SET_VECTOR_ELT(s_global_best_x, j, ScalarLogical(LOGICAL(s_pop_col)[pop_i]));
-                    }
-                }
-            }
+        }
+        cfg_copy_row(pop_x, pop_i, cand_x, pop_i, ss);
+        stagnate_count[pop_i] = 0;
+        pop_y[pop_i] = cand_y[pop_i];
+        n_improved++;
+        // Update global best if improved
+        if (pop_y[pop_i] < *global_best_y) {
+            *global_best_y = pop_y[pop_i];
+            cfg_copy_row(global_best_x, 0, pop_x, pop_i, ss);
         }
     }
+    return n_improved;
+}
+
+// Copy the best neighbor from each block into the population
+// Also update global best-so-far when an improvement is found
+void copy_best_neighs_to_pop(const Configs *neighs_x, const double* neighs_y,
+  Configs *pop_x, double *pop_y, int* stagnate_count,
+  double *global_best_y, Configs *global_best_x,
+  const SearchSpace* ss, const Control* ctrl) {
+
+    DEBUG_PRINT("copy_best_neighs_to_pop\n");
+
+    Configs cand_x;
+    cfg_alloc(&cand_x, ctrl->n_searches, ss);
+    double *cand_y = (double*) R_alloc(ctrl->n_searches, sizeof(double));
+    memcpy(cand_y, pop_y, ctrl->n_searches * sizeof(double));
+    update_cands(neighs_x, neighs_y, NULL, ctrl->n_searches, ctrl->n_neighs, &cand_x, cand_y, ss);
+    accept_cands(&cand_x, cand_y, pop_x, pop_y, stagnate_count, global_best_y, global_best_x, ss, ctrl);
 
     DEBUG_PRINT("copy_best_neighs_to_pop done\n");
 }
 
 
+typedef struct {
+    SEXP s_dt;
+    R_xlen_t n_rows;
+    SEXP s_rownames;
+} DtRows;
+
+// set the number of rows of a DT in place, at most the number of rows it was allocated with
+static void dt_set_nrows(void *data) {
+    const DtRows *rows = (const DtRows*) data;
+    for (int j = 0; j < length(rows->s_dt); j++) {
+        SETLENGTH(VECTOR_ELT(rows->s_dt, j), rows->n_rows);
+    }
+    setAttrib(rows->s_dt, R_RowNamesSymbol, rows->s_rownames);
+}
+
+static SEXP safe_eval_data(void *data) {
+    return safe_eval((SEXP) data);
+}
+
+// Call the objective on the first n rows of s_x.
+// A DT with more rows is shortened in place for the call, so all chunks share one DT,
+// its length is restored afterwards, also if the objective throws an error.
 int eval_obj(int n, SEXP s_x, SEXP s_obj, double* y, const Control* ctrl) {
     SEXP s_call = PROTECT(Rf_lang2(s_obj, s_x));
-    SEXP s_y = PROTECT(safe_eval(s_call));
+    R_xlen_t n_rows = RC_dt_nrows(s_x);
+    SEXP s_y;
+    if (n < n_rows) {
+        DtRows view = {s_x, n, PROTECT(dt_rownames(n))};
+        DtRows full = {s_x, n_rows, PROTECT(dt_rownames(n_rows))};
+        dt_set_nrows(&view);
+        s_y = R_ExecWithCleanup(safe_eval_data, s_call, dt_set_nrows, &full);
+        UNPROTECT(2); // view.s_rownames, full.s_rownames
+    } else {
+        s_y = safe_eval(s_call);
+    }
+    PROTECT(s_y);
     int eval_ok = 0;
     if (s_y != R_NilValue) {
         memcpy(y, REAL(s_y), n * sizeof(double));
@@ -655,8 +1479,87 @@ int eval_obj(int n, SEXP s_x, SEXP s_obj, double* y, const Control* ctrl) {
     return eval_ok;
 }
 
+// set up the objective, native objectives are passed as external pointers created by bbotk_native_objective_create
+void extract_objective(SEXP s_obj, Objective *obj) {
+    obj->s_obj = s_obj;
+    obj->native = NULL;
+    if (TYPEOF(s_obj) == EXTPTRSXP) {
+        if (R_ExternalPtrTag(s_obj) != Rf_install("bbotk_native_objective") || R_ExternalPtrAddr(s_obj) == NULL) {
+            error("External pointer is not a valid native objective");
+        }
+        obj->native = (const bbotk_native_objective*) R_ExternalPtrAddr(s_obj);
+    }
+}
 
-SEXP get_best_pop_element(SEXP s_pop_x, const double* pop_y, const SearchSpace* ss, const Control* ctrl) {
+// Evaluate the objective on a block of configs.
+// Native objectives get the configs directly, for R functions we write them into the (preallocated) DT first.
+// Returns 0 if the search should stop.
+int eval_obj_cfg(const Configs *cfg, SEXP s_x, const Objective *obj, double* y, const SearchSpace* ss, const Control* ctrl) {
+    if (obj->native != NULL) {
+        if (obj->native->fn(cfg, y, obj->native->data) != 0) {
+            return 0;
+        }
+        // multiply by obj_mult to handle maximization
+        for (int i = 0; i < cfg->n_rows; i++) {
+            y[i] *= ctrl->obj_mult;
+        }
+        return 1;
+    }
+    cfg_to_dt(cfg, NULL, cfg->n_rows, s_x, ss);
+    return eval_obj(cfg->n_rows, s_x, obj->s_obj, y, ctrl);
+}
+
+// Evaluate the neighbors through the cache.
+// Only configs that were never evaluated before are passed to the objective, duplicates within the batch only once.
+// Neighbors visited by a search within the last tabu_size steps get +Inf, so they are never accepted.
+// Returns 0 if the search should stop.
+int eval_neighs_cached(const Configs *neighs_x, SEXP s_neighs_x, double *neighs_y, Cache *cache, int step,
+  const Objective *obj, const SearchSpace* ss, const Control* ctrl) {
+
+    int n = neighs_x->n_rows;
+    int n_miss = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t hash = cfg_hash_row(neighs_x, i, ss);
+        int k = cache_find(cache, neighs_x, i, hash, ss);
+        if (k == -1) {
+            k = cache_insert(cache, neighs_x, i, hash, R_NaN, ss);
+            cache->miss_rows[n_miss++] = i;
+        }
+        cache->entry_idx[i] = k;
+    }
+    DEBUG_PRINT("cache: %d of %d neighbors are new, %d entries\n", n_miss, n, cache->n);
+
+    if (n_miss > 0) {
+        int eval_ok;
+        if (obj->native != NULL) {
+            Configs *miss_x = &cache->miss_x;
+            for (int m = 0; m < n_miss; m++) {
+                cfg_copy_row(miss_x, m, neighs_x, cache->miss_rows[m], ss);
+            }
+            miss_x->n_rows = n_miss;
+            eval_ok = eval_obj_cfg(miss_x, R_NilValue, obj, cache->miss_y, ss, ctrl);
+            miss_x->n_rows = n;
+        } else {
+            // the misses are passed as the first rows of the preallocated DT
+            cfg_to_dt(neighs_x, cache->miss_rows, n_miss, s_neighs_x, ss);
+            eval_ok = eval_obj(n_miss, s_neighs_x, obj->s_obj, cache->miss_y, ctrl);
+        }
+        if (!eval_ok) return 0;
+        for (int m = 0; m < n_miss; m++) {
+            cache->y[cache->entry_idx[cache->miss_rows[m]]] = cache->miss_y[m];
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        int k = cache->entry_idx[i];
+        int is_tabu = cache->last_visit[k] >= 0 && step - cache->last_visit[k] <= ctrl->tabu_size;
+        neighs_y[i] = is_tabu ? R_PosInf : cache->y[k];
+    }
+    return 1;
+}
+
+
+SEXP get_best_pop_element(const Configs *pop_x, const double* pop_y, const SearchSpace* ss, const Control* ctrl) {
     // find the best point in the population
     double best_y = pop_y[0];
     int best_i = 0;
@@ -668,167 +1571,393 @@ SEXP get_best_pop_element(SEXP s_pop_x, const double* pop_y, const SearchSpace*
     }
     best_y *= ctrl->obj_mult; // convert to original scale
     SEXP s_res = PROTECT(RC_named_list_create(2, (const char*[]){"x", "y"}));
-    SEXP s_res_x = PROTECT(RC_named_list_create(ss->n_params, ss->param_names));
-
-
-    for (int j = 0; j < ss->n_params; j++) {
-      int param_class = ss->param_classes[j];
-      SEXP s_pop_col = VECTOR_ELT(s_pop_x, j);
-
-      if (param_class == 0) { // ParamDbl
-          SET_VECTOR_ELT(s_res_x, j, ScalarReal(REAL(s_pop_col)[best_i]));
-      } else if (param_class == 1) { // ParamInt
-          SET_VECTOR_ELT(s_res_x, j, ScalarInteger(INTEGER(s_pop_col)[best_i]));
-      } else if (param_class == 2) { // ParamFct
-          SET_VECTOR_ELT(s_res_x, j, ScalarString(STRING_ELT(s_pop_col, best_i)));
-      } else { // ParamLgl
-          SET_VECTOR_ELT(s_res_x, j, ScalarLogical(LOGICAL(s_pop_col)[best_i]));
-      }
-    }
-    SET_VECTOR_ELT(s_res, 0, s_res_x);
+    SET_VECTOR_ELT(s_res, 0, cfg_row_to_list(pop_x, best_i, ss));
     SET_VECTOR_ELT(s_res, 1, ScalarReal(best_y));
-    UNPROTECT(2); // s_res_x, s_res
+    UNPROTECT(1); // s_res
     return s_res;
 }
 
-void restart_stagnated_searches(SEXP s_pop_x, double *pop_y, int *stagnate_count, const SearchSpace* ss, const Control* ctrl) {
+// restarts draw from the streams after the ones of the neighbors in the same step
+// Returns the number of restarted searches
+int restart_stagnated_searches(Configs *pop_x, double *pop_y, int *stagnate_count, const SearchSpace* ss, const Control* ctrl,
+  uint64_t key, uint64_t step) {
+  int n_restarts = 0;
   for (int i = 0; i < ctrl->n_searches; i++) {
     if (stagnate_count[i] >= ctrl->stagnate_max) { // restart if stagnated for too long
       DEBUG_PRINT("restarted search %d, stagnate_count: %d, stagnate_max: %d\n", i, stagnate_count[i], ctrl->stagnate_max);
-      dt_set_random_row(s_pop_x, i, ss);
-      dt_repair_row(s_pop_x, i, ss);
+      Rng rng = {key, rng_stream(step, (uint64_t) ctrl->n_searches * ctrl->n_neighs + i), 0};
+      cfg_set_random_row(pop_x, i, ss, &rng);
+      cfg_repair_row(pop_x, i, ss, &rng);
       // Force acceptance of a neighbor by setting current objective to +Inf
       pop_y[i] = R_PosInf;
       stagnate_count[i] = 0;
+      n_restarts++;
     }
   }
+  return n_restarts;
 }
 
-void dt_set_random_row(SEXP s_dt, int row_i, const SearchSpace* ss) {
+// Repair all points of the population once, points given by the user or restored from a state
+// can violate the conditions, the steps afterwards only repair the descendants of the mutated param.
+// Draws from the streams after the ones of the restarts in the same step.
+// A repaired point of a restored state loses its y, so it accepts its next neighbor like a restarted search.
+void repair_pop(Configs *pop_x, double *pop_y, const SearchSpace* ss, const Control* ctrl, uint64_t key, uint64_t step) {
+  for (int i = 0; i < ctrl->n_searches; i++) {
+    Rng rng = {key, rng_stream(step, (uint64_t) ctrl->n_searches * (ctrl->n_neighs + 1) + i), 0};
+    uint64_t hash = pop_y != NULL ? cfg_hash_row(pop_x, i, ss) : 0;
+    cfg_repair_row(pop_x, i, ss, &rng);
+    if (pop_y != NULL && cfg_hash_row(pop_x, i, ss) != hash) pop_y[i] = R_PosInf;
+  }
+}
+
+void cfg_set_random_row(Configs *cfg, int row_i, const SearchSpace* ss, Rng *rng) {
   for (int j = 0; j < ss->n_params; j++) {
-    dt_set_random(s_dt, row_i, j, ss);
+    cfg_set_random(cfg, row_i, j, ss, rng);
   }
 }
 
 // fix a parameter value which is in conflict with its condition value´
 // case 1: if any condition is not satisfied, set the parameter to NA
 // case 2: if all conditions are satisfied, but the parameter is NA, set it to a random value
-void check_and_fix_param_value(SEXP s_neighs_x, int neigh_i, int param_j, int all_conds_satisfied, const SearchSpace* ss) {
+void check_and_fix_param_value(Configs *cfg, int row_i, int param_j, int all_conds_satisfied, const SearchSpace* ss, Rng *rng) {
   if(!all_conds_satisfied) {
     DEBUG_PRINT("Setting parameter %s to NA.\n", ss->param_names[param_j]);
-    dt_set_na(s_neighs_x, neigh_i, param_j);
-  } else if (dt_is_na(s_neighs_x, neigh_i, param_j)) {
+    cfg_set_na(cfg, row_i, param_j);
+  } else if (cfg_is_na(cfg, row_i, param_j)) {
     DEBUG_PRINT("Setting parameter %s to random value.\n", ss->param_names[param_j]);
-    dt_set_random(s_neighs_x, neigh_i, param_j, ss);
+    cfg_set_random(cfg, row_i, param_j, ss, rng);
   }
 }
 
 
-void dt_repair_row(SEXP s_dt, int row_i, const SearchSpace* ss) {
-  // Iterate through topologically sorted conditions
-  int param_index_current = -1;
-  int all_conds_satisfied = 1;
-  for (int c = 0; c < ss->n_conds; c++) {
-      Cond* cond = &ss->conds[c];
-      if (param_index_current != cond->param_index) {
-          // finished processing all conditions for a particular parameter
-          // now see and fix if its value is in conflict with its conditions
-          if (param_index_current > -1) {
-              check_and_fix_param_value(s_dt, row_i, param_index_current, all_conds_satisfied, ss);
-          }
-          // reset values for next parameter
-          all_conds_satisfied = 1;
-          param_index_current = cond->param_index;
-      }
-      if (!is_condition_satisfied(s_dt, row_i, cond, ss)) {
-          all_conds_satisfied = 0;
-          DEBUG_PRINT("not satisfied:\n");
-          dt_print_row(s_dt, row_i);
-      } else {
-          DEBUG_PRINT("satisfied:\n");
-          dt_print_row(s_dt, row_i);
-      }
-  }
-  // explicit check for the last condition
-  if (ss->n_conds > 0) {
-      check_and_fix_param_value(s_dt, row_i, param_index_current, all_conds_satisfied, ss);
-  }
+// check all conditions of param_j, fix its value if it is in conflict
+static void cfg_repair_param(Configs *cfg, int row_i, int param_j, const SearchSpace* ss, Rng *rng) {
+    int all_conds_satisfied = 1;
+    for (int c = ss->cond_start[param_j]; c < ss->cond_end[param_j] && all_conds_satisfied; c++) {
+        all_conds_satisfied = is_condition_satisfied(cfg, row_i, &ss->conds[c], ss);
+    }
+    check_and_fix_param_value(cfg, row_i, param_j, all_conds_satisfied, ss, rng);
+}
 
-  DEBUG_PRINT("after repair:\n");
-  dt_print_row(s_dt, row_i);
+// repair all params with conditions, in topological order
+void cfg_repair_row(Configs *cfg, int row_i, const SearchSpace* ss, Rng *rng) {
+    for (int i = 0; i < ss->n_params; i++) {
+        int j = ss->sorted_param_indices[i];
+        if (ss->cond_start[j] < ss->cond_end[j]) {
+            cfg_repair_param(cfg, row_i, j, ss, rng);
+        }
+    }
+    DEBUG_PRINT("after repair:\n");
+    cfg_print_row(cfg, row_i, ss);
+}
+
+// repair after param_j was changed in a valid row: only its descendants can be in conflict,
+// we visit them in topological order, so a param is fixed after all of its parents
+void cfg_repair_descendants(Configs *cfg, int row_i, int param_j, const SearchSpace* ss, Rng *rng) {
+    for (int d = ss->desc_start[param_j]; d < ss->desc_start[param_j + 1]; d++) {
+        cfg_repair_param(cfg, row_i, ss->desc[d], ss, rng);
+    }
+    DEBUG_PRINT("after repair:\n");
+    cfg_print_row(cfg, row_i, ss);
+}
+
+
+/************ Search step ********** */
+
+
+// Generate and evaluate the neighbors of one step, in chunks of chunk_size neighbors per search,
+// then move every search to its best neighbor if it improved.
+// With first improvement, a search gets no more chunks in this step after a chunk improved it.
+// neighs_x, s_neighs_x and neighs_y hold one chunk of all searches, smaller chunks use the first rows of s_neighs_x,
+// cand_x, cand_y, searches and valid_mutable_indices are scratch memory,
+// cache, topk and instr are NULL if not used, all evaluated neighbors are offered to topk.
+// Returns 0 if the search should stop, the best point of the completed chunks is then still kept as global best.
+int search_step(Configs *pop_x, double *pop_y, int *stagnate_count, double *global_best_y, Configs *global_best_x,
+  Configs *neighs_x, SEXP s_neighs_x, double *neighs_y, Configs *cand_x, double *cand_y, int *searches,
+  int *valid_mutable_indices, Cache *cache, TopK *topk, Instr *instr, int cache_step, const Objective *obj, const SearchSpace* ss, const Control* ctrl,
+  uint64_t key, uint64_t step) {
+
+    int n_evals = 0;
+    int n_unmutated_before = instr != NULL ? instr_sum_unmutated(instr) : 0;
+    double t0 = instr != NULL ? instr_now() : 0, t1;
+    int n_chunk_max = ctrl->n_searches * ctrl->chunk_size;
+    int n_active = ctrl->n_searches;
+    for (int i = 0; i < ctrl->n_searches; i++) {
+        searches[i] = i;
+        cand_y[i] = pop_y[i];
+    }
+
+    int eval_ok = 1;
+    for (int k_start = 0; k_start < ctrl->n_neighs && n_active > 0; k_start += ctrl->chunk_size) {
+        int k_len = ctrl->chunk_size < ctrl->n_neighs - k_start ? ctrl->chunk_size : ctrl->n_neighs - k_start;
+        int n = n_active * k_len;
+        DEBUG_PRINT("chunk k_start=%d, k_len=%d, n_active=%d\n", k_start, k_len, n_active);
+        neighs_x->n_rows = n;
+        generate_neighs_chunk(pop_x, searches, n_active, k_start, k_len, neighs_x, valid_mutable_indices,
+            ss, ctrl, key, step, instr);
+        if (instr != NULL) {
+            t1 = instr_now();
+            instr->t_generate += t1 - t0;
+            t0 = t1;
+        }
+        int n_cached_before = cache != NULL ? cache->n : 0;
+        if (cache != NULL) {
+            eval_ok = eval_neighs_cached(neighs_x, s_neighs_x, neighs_y, cache, cache_step, obj, ss, ctrl);
+        } else {
+            eval_ok = eval_obj_cfg(neighs_x, s_neighs_x, obj, neighs_y, ss, ctrl);
+        }
+        // the cache gets one new entry per evaluated config
+        n_evals += cache != NULL ? cache->n - n_cached_before : n;
+        if (instr != NULL) {
+            t1 = instr_now();
+            instr->t_eval += t1 - t0;
+            t0 = t1;
+        }
+        if (!eval_ok) break;
+        if (topk != NULL) {
+            for (int i = 0; i < n; i++) topk_offer(topk, neighs_x, i, neighs_y[i], ss);
+        }
+        update_cands(neighs_x, neighs_y, searches, n_active, k_len, cand_x, cand_y, ss);
+
+        if (ctrl->first_improvement) {
+            int n_still_active = 0;
+            for (int a = 0; a < n_active; a++) {
+                int pop_i = searches[a];
+                if (!(cand_y[pop_i] < pop_y[pop_i])) searches[n_still_active++] = pop_i;
+            }
+            n_active = n_still_active;
+        }
+        if (instr != NULL) {
+            t1 = instr_now();
+            instr->t_select += t1 - t0;
+            t0 = t1;
+        }
+    }
+    neighs_x->n_rows = n_chunk_max;
+
+    if (!eval_ok) {
+        for (int i = 0; i < ctrl->n_searches; i++) {
+            if (cand_y[i] < *global_best_y) {
+                *global_best_y = cand_y[i];
+                cfg_copy_row(global_best_x, 0, cand_x, i, ss);
+            }
+        }
+        return 0;
+    }
+    int n_improved = accept_cands(cand_x, cand_y, pop_x, pop_y, stagnate_count, global_best_y, global_best_x, ss, ctrl);
+    if (instr != NULL) {
+        instr->t_select += instr_now() - t0;
+        int s = instr->n_steps++;
+        instr->step_improved[s] = n_improved;
+        instr->step_evals[s] = n_evals;
+        instr->step_unmutated[s] = instr_sum_unmutated(instr) - n_unmutated_before;
+        instr->step_best_y[s] = *global_best_y;
+    }
+    return 1;
+}
+
+
+/************ Search state ********** */
+
+// Create the state of a search, so it can be resumed later, see local_search()
+// y values are converted back to the original scale
+// Returned SEXP must be protected by the caller
+SEXP state_create(const Configs *pop_x, const double *pop_y, const int *stagnate_count, const Configs *global_best_x,
+  double global_best_y, int has_best, uint64_t key, uint64_t step, const SearchSpace *ss, const Control *ctrl) {
+    int n = ctrl->n_searches;
+    SEXP s_state = PROTECT(RC_named_list_create(7, (const char*[]){"pop_x", "pop_y", "stagnate_count",
+        "best_x", "best_y", "rng_key", "step"}));
+    SEXP s_pop_x = PROTECT(dt_generate(n, ss));
+    cfg_to_dt(pop_x, NULL, n, s_pop_x, ss);
+    SET_VECTOR_ELT(s_state, 0, s_pop_x);
+    SEXP s_pop_y = PROTECT(allocVector(REALSXP, n));
+    SEXP s_stagnate_count = PROTECT(allocVector(INTSXP, n));
+    for (int i = 0; i < n; i++) {
+        REAL(s_pop_y)[i] = pop_y[i] * ctrl->obj_mult;
+        INTEGER(s_stagnate_count)[i] = stagnate_count[i];
+    }
+    SET_VECTOR_ELT(s_state, 1, s_pop_y);
+    SET_VECTOR_ELT(s_state, 2, s_stagnate_count);
+    if (has_best) {
+        SEXP s_best_x = PROTECT(dt_generate(1, ss));
+        cfg_to_dt(global_best_x, NULL, 1, s_best_x, ss);
+        SET_VECTOR_ELT(s_state, 3, s_best_x);
+        UNPROTECT(1); // s_best_x
+    }
+    SET_VECTOR_ELT(s_state, 4, ScalarReal(global_best_y * ctrl->obj_mult));
+    // the 64-bit key as two exact 32-bit halves, doubles cannot hold it in one piece
+    SEXP s_key = PROTECT(allocVector(REALSXP, 2));
+    REAL(s_key)[0] = (double) (key >> 32);
+    REAL(s_key)[1] = (double) (key & 0xffffffffULL);
+    SET_VECTOR_ELT(s_state, 5, s_key);
+    SET_VECTOR_ELT(s_state, 6, ScalarReal((double) step));
+    Rf_setAttrib(s_state, R_ClassSymbol, mkString("local_search_state"));
+    UNPROTECT(5); // s_state, s_pop_x, s_pop_y, s_stagnate_count, s_key
+    return s_state;
+}
+
+// Restore the search from a state created by state_create, returns whether the state has a best point
+int state_restore(SEXP s_state, Configs *pop_x, double *pop_y, int *stagnate_count, Configs *global_best_x,
+  double *global_best_y, uint64_t *key, uint64_t *step, const SearchSpace *ss, const Control *ctrl) {
+    int n = ctrl->n_searches;
+    SEXP s_pop_x = RC_get_list_el_by_name(s_state, "pop_x");
+    SEXP s_pop_y = RC_get_list_el_by_name(s_state, "pop_y");
+    SEXP s_stagnate_count = RC_get_list_el_by_name(s_state, "stagnate_count");
+    SEXP s_best_x = RC_get_list_el_by_name(s_state, "best_x");
+    SEXP s_key = RC_get_list_el_by_name(s_state, "rng_key");
+    if (RC_dt_nrows(s_pop_x) != n || length(s_pop_y) != n || length(s_stagnate_count) != n) {
+        error("State must contain exactly 'n_searches' = %d searches", n);
+    }
+    if (TYPEOF(s_pop_y) != REALSXP || TYPEOF(s_stagnate_count) != INTSXP || TYPEOF(s_key) != REALSXP || length(s_key) != 2) {
+        error("State is not valid");
+    }
+    cfg_from_dt(s_pop_x, pop_x, ss);
+    for (int i = 0; i < n; i++) {
+        pop_y[i] = REAL(s_pop_y)[i] * ctrl->obj_mult;
+        stagnate_count[i] = INTEGER(s_stagnate_count)[i];
+    }
+    *global_best_y = asReal(RC_get_list_el_by_name(s_state, "best_y")) * ctrl->obj_mult;
+    *key = ((uint64_t) REAL(s_key)[0] << 32) | (uint64_t) REAL(s_key)[1];
+    *step = (uint64_t) asReal(RC_get_list_el_by_name(s_state, "step"));
+    if (Rf_isNull(s_best_x)) {
+        *global_best_y = R_PosInf;
+        return 0;
+    }
+    cfg_from_dt(s_best_x, global_best_x, ss);
+    return 1;
 }
 
 
 // R wrapper function - complete local search implementation
+// s_initial_x is either a data.table of initial points, which are evaluated first,
+// or the state of a previous search, which is resumed without evaluating anything
 SEXP c_local_search(SEXP s_obj, SEXP s_ss, SEXP s_ctrl, SEXP s_initial_x) {
     GetRNGstate();
 
     SearchSpace ss;
-    extract_ss_info(s_ss, &ss);
-    toposort_params(&ss);
-    reorder_conds_by_toposort(&ss);
+    get_search_space(s_ss, &ss);
     Control ctrl;
     extract_ctrl_info(s_ctrl, &ctrl);
+    Objective obj;
+    extract_objective(s_obj, &obj);
+    Instr instr_data;
+    Instr *instr = NULL;
+    if (ctrl.instrument) {
+        instr = &instr_data;
+        instr_init(instr, ctrl.n_steps, ctrl.n_threads);
+    }
+    double t_start = instr != NULL ? instr_now() : 0;
 
     //print_search_space(&ss);
 
-    // Use duplicate to copy initial points
-    SEXP s_pop_x = PROTECT(duplicate(s_initial_x));
-    dt_print(s_pop_x, 10);
+    // population and neighbors live in the typed C layout,
+    // the DTs are only used to pass points to an R objective.
+    // we only hold one chunk of neighbors at a time, smaller chunks are passed as a shorter view of the same DT
+    int n_chunk_max = ctrl.n_searches * ctrl.chunk_size;
+    Configs pop_x, neighs_x, cand_x, global_best_x;
+    cfg_alloc(&pop_x, ctrl.n_searches, &ss);
+    cfg_alloc(&neighs_x, n_chunk_max, &ss);
+    cfg_alloc(&cand_x, ctrl.n_searches, &ss);
+    cfg_alloc(&global_best_x, 1, &ss);
 
-    SEXP s_neighs_x = PROTECT(dt_generate(ctrl.n_searches * ctrl.n_neighs, &ss));
+    SEXP s_pop_x = PROTECT(obj.native ? R_NilValue : dt_generate(ctrl.n_searches, &ss));
+    SEXP s_neighs_x = PROTECT(obj.native ? R_NilValue : dt_generate(n_chunk_max, &ss));
 
     // y-values for pop. we wil later write into this array
     double *pop_y = (double*) R_alloc(ctrl.n_searches, sizeof(double));
-    double *neighs_y = (double*) R_alloc(ctrl.n_searches*ctrl.n_neighs, sizeof(double));
+    double *neighs_y = (double*) R_alloc(n_chunk_max, sizeof(double));
+    double *cand_y = (double*) R_alloc(ctrl.n_searches, sizeof(double));
+    int *searches = (int*) R_alloc(ctrl.n_searches, sizeof(int));
+    // per thread scratch of the neighbor generation, shared by all chunks and steps
+    int *valid_mutable_indices = (int*) R_alloc((size_t) ctrl.n_threads * ss.n_params, sizeof(int));
     int *stagnate_count = (int*) R_alloc(ctrl.n_searches, sizeof(int));
     memset(stagnate_count, 0, ctrl.n_searches * sizeof(int));
+    double global_best_y = R_PosInf;
+    int has_best = 0;
+    uint64_t rng_key;
+    uint64_t step_offset = 0; // number of steps done in previous calls
     int eval_ok;
-    eval_ok = eval_obj(ctrl.n_searches, s_pop_x, s_obj, pop_y, &ctrl);
 
-    // Initialize global best from current population
-    double global_best_y = R_PosInf;
-    int global_best_i = -1;
-    if (eval_ok) {
-        for (int i = 0; i < ctrl.n_searches; i++) {
-            if (pop_y[i] < global_best_y) {
-                global_best_y = pop_y[i];
-                global_best_i = i;
+    if (Rf_inherits(s_initial_x, "local_search_state")) {
+        has_best = state_restore(s_initial_x, &pop_x, pop_y, stagnate_count, &global_best_x, &global_best_y,
+            &rng_key, &step_offset, &ss, &ctrl);
+        repair_pop(&pop_x, pop_y, &ss, &ctrl, rng_key, step_offset);
+        eval_ok = 1;
+    } else {
+        rng_key = rng_key_from_r();
+        cfg_from_dt(s_initial_x, &pop_x, &ss);
+        repair_pop(&pop_x, NULL, &ss, &ctrl, rng_key, 0);
+        double t0 = instr != NULL ? instr_now() : 0;
+        eval_ok = eval_obj_cfg(&pop_x, s_pop_x, &obj, pop_y, &ss, &ctrl);
+        if (instr != NULL) instr->t_eval += instr_now() - t0;
+        // Initialize global best from current population
+        int global_best_i = -1;
+        if (eval_ok) {
+            for (int i = 0; i < ctrl.n_searches; i++) {
+                if (pop_y[i] < global_best_y) {
+                    global_best_y = pop_y[i];
+                    global_best_i = i;
+                }
             }
         }
+        if (global_best_i >= 0) {
+            cfg_copy_row(&global_best_x, 0, &pop_x, global_best_i, &ss);
+            has_best = 1;
+        }
     }
-    SEXP s_global_best_x = PROTECT(RC_named_list_create(ss.n_params, ss.param_names));
-    if (global_best_i >= 0) {
-        for (int j = 0; j < ss.n_params; j++) {
-            int param_class = ss.param_classes[j];
-            SEXP s_pop_col = VECTOR_ELT(s_pop_x, j);
-            if (param_class == 0) {
-                SET_VECTOR_ELT(s_global_best_x, j, ScalarReal(REAL(s_pop_col)[global_best_i]));
-            } else if (param_class == 1) {
-                SET_VECTOR_ELT(s_global_best_x, j, ScalarInteger(INTEGER(s_pop_col)[global_best_i]));
-            } else if (param_class == 2) {
-                SET_VECTOR_ELT(s_global_best_x, j, ScalarString(STRING_ELT(s_pop_col, global_best_i)));
-            } else {
-                SET_VECTOR_ELT(s_global_best_x, j, ScalarLogical(LOGICAL(s_pop_col)[global_best_i]));
+    cfg_print(&pop_x, 10, &ss);
+
+    // optional set of the best distinct configs, a resumed search starts it with its current points.
+    // points without a finite y were not evaluated, e.g. restored points changed by repair_pop(),
+    // they are neither offered to the set nor put into the cache
+    TopK topk;
+    if (ctrl.top_k > 0) {
+        topk_init(&topk, ctrl.top_k, ctrl.min_dist, &ss);
+        if (eval_ok) {
+            for (int i = 0; i < ctrl.n_searches; i++) {
+                if (R_FINITE(pop_y[i])) topk_offer(&topk, &pop_x, i, pop_y[i], &ss);
             }
         }
     }
 
+    // optional cache of all evaluated configs, the initial points count as visited before the first step
+    Cache cache;
+    if (ctrl.cache && eval_ok) {
+        cache_init(&cache, ctrl.n_searches + ctrl.n_searches * ctrl.n_neighs, n_chunk_max, &ss);
+        for (int i = 0; i < ctrl.n_searches; i++) {
+            if (!R_FINITE(pop_y[i])) continue;
+            uint64_t hash = cfg_hash_row(&pop_x, i, &ss);
+            int k = cache_find(&cache, &pop_x, i, hash, &ss);
+            if (k == -1) k = cache_insert(&cache, &pop_x, i, hash, pop_y[i], &ss);
+            cache.last_visit[k] = 0;
+        }
+    }
+
     // we failed the terminator in the initial points, skip main loop
+    int n_steps_done = 0;
     if (eval_ok) {
         // Main local search loop
         for (int step = 0; step < ctrl.n_steps;  step++) {
             DEBUG_PRINT("step=%i\n", step);
-            dt_print(s_pop_x, 10);
-
-            restart_stagnated_searches(s_pop_x, pop_y, stagnate_count, &ss, &ctrl);
-            generate_neighs(s_pop_x, s_neighs_x, &ss, &ctrl);
-            // print_dt(s_neighs_x, 10);
-            eval_ok = eval_obj(ctrl.n_searches*ctrl.n_neighs, s_neighs_x, s_obj, neighs_y, &ctrl);
+            cfg_print(&pop_x, 10, &ss);
+
+            uint64_t rng_step = step_offset + step;
+            double t0 = instr != NULL ? instr_now() : 0;
+            int n_restarts = restart_stagnated_searches(&pop_x, pop_y, stagnate_count, &ss, &ctrl, rng_key, rng_step);
+            if (instr != NULL) {
+                instr->t_restart += instr_now() - t0;
+                instr->step_restarts[instr->n_steps] = n_restarts;
+            }
+            eval_ok = search_step(&pop_x, pop_y, stagnate_count, &global_best_y, &global_best_x,
+                &neighs_x, s_neighs_x, neighs_y, &cand_x, cand_y, searches, valid_mutable_indices,
+                ctrl.cache ? &cache : NULL, ctrl.top_k > 0 ? &topk : NULL, instr,
+                step + 1, &obj, &ss, &ctrl, rng_key, rng_step);
 
-            // copy if we have a valid result, otherwise we stop the loop
+            // stop the loop if we have no valid result
             if (eval_ok) {
-                copy_best_neighs_to_pop(s_neighs_x, neighs_y, s_pop_x, pop_y, stagnate_count, &global_best_y, s_global_best_x, &ss, &ctrl);
+                if (ctrl.cache) cache_mark_visited(&cache, &pop_x, stagnate_count, step + 1, &ss);
+                has_best = 1;
+                n_steps_done++;
             } else {
                 break;
             }
@@ -837,10 +1966,27 @@ SEXP c_local_search(SEXP s_obj, SEXP s_ss, SEXP s_ctrl, SEXP s_initial_x) {
 
     PutRNGstate();
     // Build result from global best (convert y back to original scale)
+    // if the initial points were never evaluated, x is a list of NULLs and there is no state to resume from
     double best_y_out = global_best_y * ctrl.obj_mult;
-    SEXP s_res = PROTECT(RC_named_list_create(2, (const char*[]){"x", "y"}));
+    SEXP s_global_best_x = has_best ?
+        cfg_row_to_list(&global_best_x, 0, &ss) : RC_named_list_create(ss.n_params, ss.param_names);
+    PROTECT(s_global_best_x);
+    SEXP s_state = has_best ?
+        state_create(&pop_x, pop_y, stagnate_count, &global_best_x, global_best_y, has_best,
+            rng_key, step_offset + n_steps_done, &ss, &ctrl) : R_NilValue;
+    PROTECT(s_state);
+    SEXP s_top = PROTECT(ctrl.top_k > 0 ? topk_to_dt(&topk, &ss, &ctrl) : R_NilValue);
+    SEXP s_res = PROTECT(RC_named_list_create(4, (const char*[]){"x", "y", "state", "top"}));
     SET_VECTOR_ELT(s_res, 0, s_global_best_x);
     SET_VECTOR_ELT(s_res, 1, ScalarReal(best_y_out));
-    UNPROTECT(4); // s_pop_x, s_neighs_x, s_global_best_x, s_res
+    SET_VECTOR_ELT(s_res, 2, s_state);
+    SET_VECTOR_ELT(s_res, 3, s_top);
+    if (instr != NULL) {
+        instr->t_total = instr_now() - t_start;
+        SEXP s_instr = PROTECT(instr_to_list(instr, &ctrl));
+        setAttrib(s_res, Rf_install("instrumentation"), s_instr);
+        UNPROTECT(1); // s_instr
+    }
+    UNPROTECT(6); // s_pop_x, s_neighs_x, s_global_best_x, s_state, s_top, s_res
     return s_res;
 }
@@ -3,6 +3,8 @@
 
 #include <R.h>
 #include <Rinternals.h>
+#include <stdint.h>
+#include "bbotk.h"
 
 
 // see docs in R/local_search.R for how the LS operates as an algorithm
@@ -33,6 +35,14 @@ typedef struct {
   int parent_index; // Index of the parent parameter
   int type;         // 0=CondEqual, 1=CondAnyOf (or similar)
   SEXP s_rhs;       // SEXP containing the RHS values (preserves original types)
+  // RHS values converted to the C layout of the parent param (double value, int value, level index or 0/1),
+  // so we can check conditions without touching R objects (e.g. from worker threads)
+  int n_rhs;
+  double *rhs_values;
+  // typed RHS sets, depending on the class of the parent
+  int *rhs_ints;      // ParamInt: sorted, unique values
+  int n_rhs_ints;
+  uint64_t *rhs_bits; // ParamFct: bitset over the level indices, ParamLgl: bits 0 (FALSE) and 1 (TRUE)
 } Cond;
 
 // Data structures for search space information
@@ -44,6 +54,8 @@ typedef struct {
   int *n_levels;
   const char ***level_names; // Array of arrays of level names for factors, only
                              // used for factors (not logicals)
+  SEXP **level_chars;        // Same as level_names, but the CHARSXPs, so we can write
+                             // factor values into a data.table without mkChar
   const char **param_names;  // Parameter names for data.table columns
 
   // Array of condition objects
@@ -53,9 +65,41 @@ typedef struct {
   // Topologically sorted parameter indices (parameters that depend on others
   // come after them)
   int *sorted_param_indices;
+
+  // compiled condition graph, built by toposort_params and reorder_conds_by_toposort
+  int *cond_start;  // conds of param j are conds[cond_start[j] .. cond_end[j] - 1]
+  int *cond_end;
+  int *desc_start;  // descendants of param j, in topological order, are desc[desc_start[j] .. desc_start[j + 1] - 1]
+  int *desc;
 } SearchSpace;
 
 
+// Compact, typed storage for a block of configurations (population, neighbors, ...).
+// We run the complete search on this layout and only convert to a data.table when
+// we have to call an R objective; native objectives get the layout directly.
+// See bbotk_configs in inst/include/bbotk.h for the description of the layout.
+typedef bbotk_configs Configs;
+
+// splitmix64 finalizer, a good 64-bit mixing function
+static inline uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// get / set a single bit in a packed bitmask column
+static inline int bit_get(const uint64_t *bits, int i) {
+  return (int) ((bits[i >> 6] >> (i & 63)) & 1);
+}
+static inline void bit_set(uint64_t *bits, int i, int value) {
+  uint64_t mask = (uint64_t) 1 << (i & 63);
+  if (value) bits[i >> 6] |= mask; else bits[i >> 6] &= ~mask;
+}
+
+
 // control info for local search
 typedef struct {
   int minimize;
@@ -65,34 +109,164 @@ typedef struct {
   int n_neighs;
   double mut_sd;
   int stagnate_max;
+  int n_threads;
+  int cache;     // evaluate every distinct config only once
+  int tabu_size; // neighbors accepted into the population within the last tabu_size steps are forbidden
+  int first_improvement; // a search stops generating neighbors in a step after the first chunk that improved it
+  int chunk_size;        // number of neighbors per search that are generated and evaluated together
+  int top_k;             // number of best distinct configs to return, 0 = off
+  double min_dist;       // min Gower distance between the returned configs
+  int instrument;        // collect phase timings, counters and a best-y trace
 } Control;
 
+// Objective, either an R function (called with a data.table) or a native C function (called with the Configs)
+typedef struct {
+  SEXP s_obj;
+  const bbotk_native_objective *native; // NULL for R functions
+} Objective;
+
+// Counter-based random number generator.
+// A draw is a pure function of (key, stream, counter), so we can hand out one stream per neighbor
+// and get the same numbers regardless of how neighbors are distributed over threads.
+// The key is drawn from R's RNG, so results are reproducible with set.seed().
+typedef struct {
+  uint64_t key;
+  uint64_t stream;
+  uint64_t counter;
+} Rng;
+
+// Stream of the i-th random draw consumer in a step (neighbor i, or restart of search i after all neighbors).
+// The key is drawn once per search from R's RNG and stored in the search state together with the step counter,
+// so a resumed search continues with exactly the same random numbers as an uninterrupted one.
+static inline uint64_t rng_stream(uint64_t step, uint64_t i) {
+  return (step << 32) | i;
+}
+
 
-int random_int(int a, int b);
-double random_normal(double mean, double sd);
+// Opt-in instrumentation of a search, see local_search_control(instrument = TRUE).
+// Timings are seconds of a monotonic clock. copy, mutate and repair are measured per neighbor on the worker threads
+// and summed over them, all other phases are wall time of the main thread.
+// Per thread values are INSTR_PAD elements apart, so threads do not share cache lines.
+#define INSTR_PAD 8
+typedef struct {
+  double t_total, t_restart, t_generate, t_eval, t_select;
+  double *t_copy, *t_mutate, *t_repair;
+  int *n_unmutated; // neighbors without an active param to mutate
+  int n_threads;
+  // counters and trace, one element per completed step
+  int n_steps;
+  int *step_restarts, *step_improved, *step_evals, *step_unmutated;
+  double *step_best_y;
+} Instr;
+
+// Hash table of all evaluated configs, keyed on the canonical encoding of a row (NA slots are zeroed).
+// Entries are never removed, all memory is allocated with R_alloc and grows by doubling.
+typedef struct {
+  Configs x;        // stored configs, entry k is row k
+  double *y;        // objective values (multiplied with obj_mult), NaN while the evaluation is pending
+  uint64_t *hashes; // hash of every entry
+  int *last_visit;  // step in which the entry was last accepted into the population, -1 if never
+  int n;            // number of entries
+  int *slots;       // open addressing table with linear probing, entry index or -1
+  int n_slots;      // power of 2, always twice the capacity of x, so the table is at most half full
+  // scratch space for one batch of neighbors
+  int *entry_idx;   // entry of each neighbor
+  int *miss_rows;   // neighbors which have to be evaluated
+  double *miss_y;
+  Configs miss_x;   // miss rows copied together, for native objectives
+} Cache;
+
+// The k best distinct configs evaluated so far, with pairwise Gower distance >= min_dist.
+// Max-heap on y, so the worst kept config is at the root and most offers are rejected with one comparison.
+// heap is a permutation of all k slots, heap[0 .. n - 1] is the heap, the rest are the free slots.
+typedef struct {
+  Configs x;      // config of slot s is row s
+  double *y;      // objective value of slot s (multiplied with obj_mult)
+  int *heap;
+  int *pos;       // position of slot s in heap
+  int *conflicts; // scratch, slots too close to an offered config
+  int n;
+  int k;
+  double min_dist;
+} TopK;
+
+// random number helpers, if rng is NULL we use R's RNG
+uint64_t rng_key_from_r(void);
+int random_int(Rng *rng, int a, int b);
+double random_unif(Rng *rng, double a, double b);
+double random_normal(Rng *rng, double mean, double sd);
+
+SEXP dt_generate(int n, const SearchSpace *ss);
 
-SEXP dt_generate(int n, SearchSpace *ss);
-void dt_set_na(SEXP s_dt, int row_i, int param_j);
-int dt_is_na(SEXP s_dt, int row_i, int param_j);
-void dt_set_random(SEXP s_dt, int row_i, int param_j, const SearchSpace *ss);
-void dt_set_random_row(SEXP s_dt, int row_i, const SearchSpace *ss);
-void dt_mutate_element(SEXP s_dt, int row_i, int param_j, const SearchSpace *ss, const Control* ctrl);
-void dt_repair_row(SEXP s_dt, int row_i, const SearchSpace *ss);
-void restart_stagnated_searches(SEXP s_pop_x, double *pop_y, int *stagnate_count, const SearchSpace* ss, const Control* ctrl);
-void check_and_fix_param_value(SEXP s_dt, int row_i, int param_j, int all_conds_satisfied, const SearchSpace *ss);
+void cfg_alloc(Configs *cfg, int n_rows, const SearchSpace *ss);
+int cfg_is_na(const Configs *cfg, int row_i, int param_j);
+void cfg_set_na(Configs *cfg, int row_i, int param_j);
+void cfg_copy_row(Configs *dst, int dst_i, const Configs *src, int src_i, const SearchSpace *ss);
+void cfg_set_random(Configs *cfg, int row_i, int param_j, const SearchSpace *ss, Rng *rng);
+void cfg_set_random_row(Configs *cfg, int row_i, const SearchSpace *ss, Rng *rng);
+void cfg_mutate_element(Configs *cfg, int row_i, int param_j, const SearchSpace *ss, const Control* ctrl, Rng *rng);
+void cfg_repair_row(Configs *cfg, int row_i, const SearchSpace *ss, Rng *rng);
+void cfg_repair_descendants(Configs *cfg, int row_i, int param_j, const SearchSpace *ss, Rng *rng);
+void repair_pop(Configs *pop_x, double *pop_y, const SearchSpace *ss, const Control* ctrl, uint64_t key, uint64_t step);
+void cfg_from_dt(SEXP s_dt, Configs *cfg, const SearchSpace *ss);
+void cfg_to_dt(const Configs *cfg, const int *rows, int n, SEXP s_dt, const SearchSpace *ss);
+SEXP cfg_row_to_list(const Configs *cfg, int row_i, const SearchSpace *ss);
+int restart_stagnated_searches(Configs *pop_x, double *pop_y, int *stagnate_count, const SearchSpace* ss, const Control* ctrl,
+  uint64_t key, uint64_t step);
+void check_and_fix_param_value(Configs *cfg, int row_i, int param_j, int all_conds_satisfied, const SearchSpace *ss, Rng *rng);
+
+uint64_t cfg_hash_row(const Configs *cfg, int row_i, const SearchSpace *ss);
+int cfg_rows_equal(const Configs *a, int a_i, const Configs *b, int b_i, const SearchSpace *ss);
+void cache_init(Cache *cache, int capacity, int batch_size, const SearchSpace *ss);
+int cache_find(const Cache *cache, const Configs *cfg, int row_i, uint64_t hash, const SearchSpace *ss);
+int cache_insert(Cache *cache, const Configs *cfg, int row_i, uint64_t hash, double y, const SearchSpace *ss);
+double cfg_dist(const Configs *a, int a_i, const Configs *b, int b_i, const SearchSpace *ss);
+void topk_init(TopK *topk, int k, double min_dist, const SearchSpace *ss);
+void topk_offer(TopK *topk, const Configs *cfg, int row_i, double y, const SearchSpace *ss);
+SEXP topk_to_dt(const TopK *topk, const SearchSpace *ss, const Control *ctrl);
+void cache_mark_visited(Cache *cache, const Configs *pop_x, const int *stagnate_count, int step, const SearchSpace *ss);
 
 void extract_ss_info(SEXP s_ss, SearchSpace *ss);
+void extract_ss_info_dt(SEXP s_data, SEXP s_deps, SearchSpace *ss);
+void get_search_space(SEXP s_ss, SearchSpace *ss);
+SEXP c_local_search_compile(SEXP s_ss);
 int find_param_index(const char *param_name, const SearchSpace *ss);
+int find_level_index(SEXP s_chr, int param_j, const SearchSpace *ss);
+void extract_cond_rhs(Cond *cond, const SearchSpace *ss);
 void extract_ctrl_info(SEXP s_ctrl, Control* ctrl);
 void toposort_params(SearchSpace *ss);
 void reorder_conds_by_toposort(SearchSpace *ss);
-int is_condition_satisfied(SEXP s_neighs_x, int i, const Cond *cond, const SearchSpace* ss);
+int is_condition_satisfied(const Configs *cfg, int i, const Cond *cond, const SearchSpace* ss);
+
 
+void extract_objective(SEXP s_obj, Objective *obj);
+int eval_obj_cfg(const Configs *cfg, SEXP s_x, const Objective *obj, double* y, const SearchSpace* ss, const Control* ctrl);
+int eval_neighs_cached(const Configs *neighs_x, SEXP s_neighs_x, double *neighs_y, Cache *cache, int step,
+  const Objective *obj, const SearchSpace* ss, const Control* ctrl);
 
-void generate_neighs(SEXP s_pop_x, SEXP s_neighs_x, const SearchSpace* ss, const Control* ctrl);
-void copy_best_neighs_to_pop(SEXP s_neighs_x, double* neighs_y, SEXP s_pop_x, double *pop_y,
-  int* stagnate_count, double *global_best_y, SEXP s_global_best_x, const SearchSpace* ss, const Control* ctrl);
+double instr_now(void);
+void instr_init(Instr *instr, int n_steps, int n_threads);
+SEXP instr_to_list(const Instr *instr, const Control *ctrl);
+void generate_neighs_chunk(const Configs *pop_x, const int *searches, int n_active, int k_start, int k_len,
+  Configs *neighs_x, int *valid_mutable_indices, const SearchSpace* ss, const Control* ctrl,
+  uint64_t key, uint64_t step, Instr *instr);
+void generate_neighs(const Configs *pop_x, Configs *neighs_x, const SearchSpace* ss, const Control* ctrl,
+  uint64_t key, uint64_t step);
+void update_cands(const Configs *neighs_x, const double* neighs_y, const int *searches, int n_active, int k_len,
+  Configs *cand_x, double *cand_y, const SearchSpace* ss);
+int accept_cands(const Configs *cand_x, const double *cand_y, Configs *pop_x, double *pop_y,
+  int* stagnate_count, double *global_best_y, Configs *global_best_x, const SearchSpace* ss, const Control* ctrl);
+void copy_best_neighs_to_pop(const Configs *neighs_x, const double* neighs_y, Configs *pop_x, double *pop_y,
+  int* stagnate_count, double *global_best_y, Configs *global_best_x, const SearchSpace* ss, const Control* ctrl);
+int search_step(Configs *pop_x, double *pop_y, int *stagnate_count, double *global_best_y, Configs *global_best_x,
+  Configs *neighs_x, SEXP s_neighs_x, double *neighs_y, Configs *cand_x, double *cand_y, int *searches,
+  int *valid_mutable_indices, Cache *cache, TopK *topk, Instr *instr, int cache_step, const Objective *obj, const SearchSpace* ss, const Control* ctrl,
+  uint64_t key, uint64_t step);
+SEXP state_create(const Configs *pop_x, const double *pop_y, const int *stagnate_count, const Configs *global_best_x,
+  double global_best_y, int has_best, uint64_t key, uint64_t step, const SearchSpace *ss, const Control *ctrl);
+int state_restore(SEXP s_state, Configs *pop_x, double *pop_y, int *stagnate_count, Configs *global_best_x,
+  double *global_best_y, uint64_t *key, uint64_t *step, const SearchSpace *ss, const Control *ctrl);
 SEXP c_local_search(SEXP s_obj, SEXP s_ss, SEXP s_ctrl, SEXP s_initial_x);
-SEXP get_best_pop_element(SEXP s_pop_x, const double* pop_y, const SearchSpace* ss, const Control* ctrl);
+SEXP get_best_pop_element(const Configs *pop_x, const double* pop_y, const SearchSpace* ss, const Control* ctrl);
 
 #endif // LOCAL_SEARCH_H
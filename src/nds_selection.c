@@ -0,0 +1,370 @@
+#include "nds_selection.h"
+
+#include <string.h>
+#include <math.h>
+
+// points are stored like the columns of the R matrix: coordinate k of point i is pts[i * d + k]
+// all objectives are minimized
+
+/***** Sorting *****/
+
+// compare points a and b by coordinate k, or lexicographically over all coordinates if k < 0
+static int pts_cmp(const double *pts, int d, int k, int a, int b) {
+    int from = k < 0 ? 0 : k;
+    int to = k < 0 ? d : k + 1;
+    for (int j = from; j < to; j++) {
+        double u = pts[a * d + j], v = pts[b * d + j];
+        if (u < v) return -1;
+        if (u > v) return 1;
+    }
+    return 0;
+}
+
+// stable bottom-up merge sort of the point indices idx[0..n-1], tmp is scratch space of the same size
+static void sort_idx(int *idx, int *tmp, int n, const double *pts, int d, int k) {
+    for (int width = 1; width < n; width *= 2) {
+        for (int lo = 0; lo < n; lo += 2 * width) {
+            int mid = lo + width < n ? lo + width : n;
+            int hi = lo + 2 * width < n ? lo + 2 * width : n;
+            int i = lo, j = mid, t = lo;
+            while (i < mid && j < hi) {
+                tmp[t++] = pts_cmp(pts, d, k, idx[j], idx[i]) < 0 ? idx[j++] : idx[i++];
+            }
+            while (i < mid) tmp[t++] = idx[i++];
+            while (j < hi) tmp[t++] = idx[j++];
+        }
+        memcpy(idx, tmp, n * sizeof(int));
+    }
+}
+
+/***** Non-dominated ranking *****/
+
+// a dominates b: a is not worse in any and better in at least one objective
+static int dominates(const double *a, const double *b, int d) {
+    int better = 0;
+    for (int j = 0; j < d; j++) {
+        if (a[j] > b[j]) return 0;
+        if (a[j] < b[j]) better = 1;
+    }
+    return better;
+}
+
+// does any point of front k dominate point p?
+// fronts are linked lists, starting with the point added last.
+// in 2-D that point has the lowest second objective of its front, so it alone decides.
+static int front_dominates(const double *pts, int d, const int *head, const int *next, int k, int p) {
+    for (int q = head[k]; q >= 0; q = next[q]) {
+        if (dominates(pts + q * d, pts + p * d, d)) return 1;
+        if (d == 2) break;
+    }
+    return 0;
+}
+
+// non-dominated ranks (0 is the first front) by efficient non-dominated sorting with binary search:
+// in lexicographic order a point can only be dominated by earlier points,
+// and if a front dominates a point all earlier fronts do, so its front is found by bisection.
+// returns the number of fronts
+static int nds_rank(const double *pts, int n, int d, int *rank) {
+    int *idx = (int*) R_alloc(n, sizeof(int));
+    int *tmp = (int*) R_alloc(n, sizeof(int));
+    int *head = (int*) R_alloc(n, sizeof(int));
+    int *next = (int*) R_alloc(n, sizeof(int));
+    for (int i = 0; i < n; i++) idx[i] = i;
+    sort_idx(idx, tmp, n, pts, d, -1);
+
+    int n_fronts = 0;
+    for (int t = 0; t < n; t++) {
+        int p = idx[t];
+        int lo = 0, hi = n_fronts;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (front_dominates(pts, d, head, next, mid, p)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == n_fronts) {
+            head[n_fronts++] = -1;
+        }
+        rank[p] = lo;
+        next[p] = head[lo];
+        head[lo] = p;
+    }
+    return n_fronts;
+}
+
+/***** Hypervolume *****/
+
+// scratch space for the hypervolume of up to n points in d dimensions
+typedef struct {
+    int d;
+    const double *ref;
+    double **buf;     // sorted copies of the points, one per dimension above 3
+    double *lim;      // points limited to the box of the point whose contribution is computed
+    int *idx, *tmp;
+    double *stair_x;  // 2-D staircase of the 3-D sweep, x ascending and y descending
+    double *stair_y;
+} HvWork;
+
+static void hv_work_init(HvWork *ws, int n, int d, const double *ref) {
+    ws->d = d;
+    ws->ref = ref;
+    ws->buf = (double**) R_alloc(d + 1, sizeof(double*));
+    for (int k = 4; k <= d; k++) {
+        ws->buf[k] = (double*) R_alloc((size_t) n * d, sizeof(double));
+    }
+    ws->lim = (double*) R_alloc((size_t) n * d, sizeof(double));
+    ws->idx = (int*) R_alloc(n, sizeof(int));
+    ws->tmp = (int*) R_alloc(n, sizeof(int));
+    ws->stair_x = (double*) R_alloc(n, sizeof(double));
+    ws->stair_y = (double*) R_alloc(n, sizeof(double));
+}
+
+// volume dominated by points in the first 3 coordinates,
+// sweeping in the third one while the dominated area of the first two is kept as a staircase
+static double hv_3d(const double *pts, int n, HvWork *ws) {
+    int d = ws->d;
+    const double *ref = ws->ref;
+    double *sx = ws->stair_x, *sy = ws->stair_y;
+    for (int i = 0; i < n; i++) ws->idx[i] = i;
+    sort_idx(ws->idx, ws->tmp, n, pts, d, 2);
+
+    int m = 0;
+    double area = 0, vol = 0;
+    for (int t = 0; t < n; t++) {
+        const double *p = pts + ws->idx[t] * d;
+        int pos = 0;
+        while (pos < m && sx[pos] <= p[0]) pos++;
+        if (pos == 0 || sy[pos - 1] > p[1]) {
+            // p is not dominated in 2-D, it replaces the stairs it dominates
+            int start = pos > 0 && sx[pos - 1] == p[0] ? pos - 1 : pos;
+            int end = pos;
+            while (end < m && sy[end] >= p[1]) end++;
+            memmove(sx + start + 1, sx + end, (m - end) * sizeof(double));
+            memmove(sy + start + 1, sy + end, (m - end) * sizeof(double));
+            m += start + 1 - end;
+            sx[start] = p[0];
+            sy[start] = p[1];
+            area = 0;
+            for (int j = 0; j < m; j++) {
+                area += ((j + 1 < m ? sx[j + 1] : ref[0]) - sx[j]) * (ref[1] - sy[j]);
+            }
+        }
+        double z_next = t + 1 < n ? pts[ws->idx[t + 1] * d + 2] : ref[2];
+        vol += area * (z_next - p[2]);
+    }
+    return vol;
+}
+
+// hypervolume dominated by points in the first dim >= 3 coordinates, all points must be strictly better than ref.
+// above 3 dimensions, slices along the last coordinate down to the 3-D sweep
+static double hv(const double *pts, int n, int dim, HvWork *ws) {
+    if (n == 0) return 0;
+    if (dim == 3) return hv_3d(pts, n, ws);
+
+    int d = ws->d;
+    double *buf = ws->buf[dim];
+    for (int i = 0; i < n; i++) ws->idx[i] = i;
+    sort_idx(ws->idx, ws->tmp, n, pts, d, dim - 1);
+    for (int t = 0; t < n; t++) {
+        memcpy(buf + t * d, pts + ws->idx[t] * d, d * sizeof(double));
+    }
+    double vol = 0;
+    for (int t = 0; t < n; t++) {
+        double z_next = t + 1 < n ? buf[(t + 1) * d + dim - 1] : ws->ref[dim - 1];
+        double width = z_next - buf[t * d + dim - 1];
+        if (width > 0) {
+            vol += hv(buf, t + 1, dim - 1, ws) * width;
+        }
+    }
+    return vol;
+}
+
+// exclusive hypervolume contribution of point p among the points in alive:
+// the volume of its box minus the volume dominated by the other points limited to that box
+static double hv_contrib(const double *pts, const int *alive, int n_alive, int p, HvWork *ws) {
+    int d = ws->d;
+    const double *ref = ws->ref;
+    const double *a = pts + p * d;
+    double box = 1;
+    for (int k = 0; k < d; k++) {
+        if (a[k] >= ref[k]) return 0;
+        box *= ref[k] - a[k];
+    }
+    int m = 0;
+    for (int t = 0; t < n_alive; t++) {
+        if (alive[t] == p) continue;
+        const double *q = pts + alive[t] * d;
+        double *l = ws->lim + m * d;
+        int inside = 1;
+        for (int k = 0; k < d; k++) {
+            l[k] = q[k] > a[k] ? q[k] : a[k];
+            if (l[k] >= ref[k]) inside = 0;
+        }
+        m += inside;
+    }
+    return box - hv(ws->lim, m, d, ws);
+}
+
+/***** Selection *****/
+
+// pick one of the positions with the lowest contribution at random, like sample() on which(x == min(x))
+static int lowest_contrib(const double *contrib, const int *pos, int n_pos, int *cand) {
+    double best = contrib[pos[0]];
+    int n_best = 0;
+    for (int t = 0; t < n_pos; t++) {
+        double c = contrib[pos[t]];
+        if (c < best) {
+            best = c;
+            n_best = 0;
+        }
+        if (c == best) cand[n_best++] = t;
+    }
+    return cand[n_best > 1 ? (int) R_unif_index(n_best) : 0];
+}
+
+// 2-D: the points of a front are ordered by the first objective, so the contribution of a point
+// only depends on its two neighbors and only the neighbors change when it is removed.
+// as in emoa, the two boundary points have an infinite contribution.
+static void remove_2d(const double *pts, const int *ties, int n_ties, int n_remove, int *removed) {
+    int *idx = (int*) R_alloc(n_ties, sizeof(int));
+    int *tmp = (int*) R_alloc(n_ties, sizeof(int));
+    memcpy(idx, ties, n_ties * sizeof(int));
+    sort_idx(idx, tmp, n_ties, pts, 2, -1);
+
+    // alive positions in sorted order, as doubly linked list and as compact array
+    int *prev = (int*) R_alloc(n_ties, sizeof(int));
+    int *next = (int*) R_alloc(n_ties, sizeof(int));
+    int *alive = (int*) R_alloc(n_ties, sizeof(int));
+    int *where = (int*) R_alloc(n_ties, sizeof(int));
+    int *cand = (int*) R_alloc(n_ties, sizeof(int));
+    double *contrib = (double*) R_alloc(n_ties, sizeof(double));
+    for (int t = 0; t < n_ties; t++) {
+        prev[t] = t - 1;
+        next[t] = t + 1 < n_ties ? t + 1 : -1;
+        alive[t] = t;
+        where[t] = t;
+    }
+    #define CONTRIB_2D(t) (prev[t] < 0 || next[t] < 0 ? R_PosInf : \
+        (pts[idx[next[t]] * 2] - pts[idx[t] * 2]) * (pts[idx[prev[t]] * 2 + 1] - pts[idx[t] * 2 + 1]))
+    for (int t = 0; t < n_ties; t++) {
+        contrib[t] = CONTRIB_2D(t);
+    }
+
+    int n_alive = n_ties;
+    for (int r = 0; r < n_remove; r++) {
+        int t = alive[lowest_contrib(contrib, alive, n_alive, cand)];
+        removed[idx[t]] = 1;
+        alive[where[t]] = alive[--n_alive];
+        where[alive[where[t]]] = where[t];
+        if (prev[t] >= 0) next[prev[t]] = next[t];
+        if (next[t] >= 0) prev[next[t]] = prev[t];
+        if (prev[t] >= 0) contrib[prev[t]] = CONTRIB_2D(prev[t]);
+        if (next[t] >= 0) contrib[next[t]] = CONTRIB_2D(next[t]);
+    }
+    #undef CONTRIB_2D
+}
+
+// 3 and more dimensions: exact contributions.
+// removing r only changes the contribution of q if the region dominated by both is not dominated by
+// a third point, otherwise the contribution of q is kept.
+static void remove_exact(const double *pts, int d, const double *ref, const int *ties, int n_ties,
+  int n_remove, int *removed) {
+
+    HvWork ws;
+    hv_work_init(&ws, n_ties, d, ref);
+    int *alive = (int*) R_alloc(n_ties, sizeof(int));
+    int *cand = (int*) R_alloc(n_ties, sizeof(int));
+    double *contrib = (double*) R_alloc(n_ties, sizeof(double));
+    double *corner = (double*) R_alloc(d, sizeof(double));
+    // contributions are indexed by position in ties, alive holds positions
+    for (int t = 0; t < n_ties; t++) alive[t] = t;
+    int *alive_pts = (int*) R_alloc(n_ties, sizeof(int));
+    memcpy(alive_pts, ties, n_ties * sizeof(int));
+    for (int t = 0; t < n_ties; t++) {
+        contrib[t] = hv_contrib(pts, alive_pts, n_ties, ties[t], &ws);
+    }
+
+    int n_alive = n_ties;
+    for (int r = 0; r < n_remove; r++) {
+        int i = lowest_contrib(contrib, alive, n_alive, cand);
+        int rp = ties[alive[i]];
+        removed[rp] = 1;
+        alive[i] = alive[--n_alive];
+        alive_pts[i] = alive_pts[n_alive];
+
+        for (int t = 0; t < n_alive; t++) {
+            int qp = alive_pts[t];
+            int inside = 1;
+            for (int k = 0; k < d; k++) {
+                double u = pts[qp * d + k], v = pts[rp * d + k];
+                corner[k] = u > v ? u : v;
+                if (corner[k] >= ref[k]) inside = 0;
+            }
+            if (!inside) continue;
+            int covered = 0;
+            for (int s = 0; s < n_alive && !covered; s++) {
+                if (s == t) continue;
+                const double *sp = pts + alive_pts[s] * d;
+                covered = 1;
+                for (int k = 0; k < d; k++) {
+                    if (sp[k] > corner[k]) {
+                        covered = 0;
+                        break;
+                    }
+                }
+            }
+            if (!covered) {
+                contrib[alive[t]] = hv_contrib(pts, alive_pts, n_alive, qp, &ws);
+            }
+        }
+    }
+}
+
+SEXP c_nds_selection(SEXP s_points, SEXP s_n_select, SEXP s_ref_point) {
+    int d = nrows(s_points);
+    int n = ncols(s_points);
+    int n_select = asInteger(s_n_select);
+    const double *pts = REAL(s_points);
+    const double *ref = REAL(s_ref_point);
+
+    int *rank = (int*) R_alloc(n, sizeof(int));
+    int n_fronts = nds_rank(pts, n, d, rank);
+    int *count = (int*) R_alloc(n_fronts, sizeof(int));
+    memset(count, 0, n_fronts * sizeof(int));
+    for (int i = 0; i < n; i++) count[rank[i]]++;
+
+    // the front where the selection ends, its points are tied
+    int last = 0, n_before = 0;
+    while (n_before + count[last] < n_select) {
+        n_before += count[last++];
+    }
+    int n_ties = 0;
+    int *ties = (int*) R_alloc(count[last], sizeof(int));
+    for (int i = 0; i < n; i++) {
+        if (rank[i] == last) ties[n_ties++] = i;
+    }
+
+    int *removed = (int*) R_alloc(n, sizeof(int));
+    memset(removed, 0, n * sizeof(int));
+    int n_remove = n_before + n_ties - n_select;
+    if (n_remove > 0) {
+        GetRNGstate();
+        if (d == 2) {
+            remove_2d(pts, ties, n_ties, n_remove, removed);
+        } else {
+            remove_exact(pts, d, ref, ties, n_ties, n_remove, removed);
+        }
+        PutRNGstate();
+    }
+
+    SEXP s_res = PROTECT(allocVector(INTSXP, n_select));
+    int *res = INTEGER(s_res);
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        if (rank[i] < last || (rank[i] == last && !removed[i])) res[k++] = i + 1;
+    }
+    UNPROTECT(1); // s_res
+    return s_res;
+}
@@ -0,0 +1,14 @@
+#ifndef NDS_SELECTION_H
+#define NDS_SELECTION_H
+
+#include <R.h>
+#include <Rinternals.h>
+
+// see docs in R/nds_selection.R
+
+// select n_select columns of the minimization matrix s_points by non-dominated sorting,
+// ties in the last front are broken by greedily removing the point with the lowest hypervolume contribution.
+// returns the sorted 1-based column indices of the survivors.
+SEXP c_nds_selection(SEXP s_points, SEXP s_n_select, SEXP s_ref_point);
+
+#endif // NDS_SELECTION_H
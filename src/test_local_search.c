@@ -28,13 +28,32 @@ SEXP c_test_get_list_el_by_name(SEXP test_list) {
 }
 
 SEXP c_test_random_int(void) {
-  SEXP s_res = PROTECT(RC_named_list_create_emptynames(2));
+  SEXP s_res = PROTECT(RC_named_list_create_emptynames(5));
   GetRNGstate();
   int k;
-  k = random_int(5, 5);
+  k = random_int(NULL, 5, 5);
   set_test_result(s_res, 0, "ok1", k == 5);
-  k = random_int(1, 2);
+  k = random_int(NULL, 1, 2);
   set_test_result(s_res, 1, "ok2", k >= 1 && k <= 2);
+
+  // counter-based streams: same (key, stream, counter) gives the same number,
+  // different streams are independent
+  uint64_t key = rng_key_from_r();
+  Rng rng1 = {key, 1, 0};
+  Rng rng2 = {key, 1, 0};
+  Rng rng3 = {key, 2, 0};
+  int ok_range = 1, ok_same = 1, n_diff = 0;
+  for (int i = 0; i < 100; i++) {
+    int k1 = random_int(&rng1, 1, 10);
+    int k2 = random_int(&rng2, 1, 10);
+    int k3 = random_int(&rng3, 1, 10);
+    ok_range &= k1 >= 1 && k1 <= 10 && k3 >= 1 && k3 <= 10;
+    ok_same &= k1 == k2;
+    n_diff += k1 != k3;
+  }
+  set_test_result(s_res, 2, "stream_range", ok_range);
+  set_test_result(s_res, 3, "stream_reproducible", ok_same);
+  set_test_result(s_res, 4, "stream_independent", n_diff > 0);
   PutRNGstate();
   UNPROTECT(1); // s_res
   return s_res;
@@ -43,7 +62,7 @@ SEXP c_test_random_int(void) {
 SEXP c_test_random_normal(void) {
   SEXP s_res = PROTECT(RC_named_list_create_emptynames(1));
   GetRNGstate();
-  double val = random_normal(0.0, 1.0);
+  double val = random_normal(NULL, 0.0, 1.0);
   // This is a weak test, but it's hard to test a random number generator.
   // We just check that the value is within a reasonable range.
   set_test_result(s_res, 0, "ok1", val > -10.0 && val < 10.0);
@@ -108,45 +127,48 @@ SEXP c_test_dt_utils(SEXP s_ss, SEXP s_ctrl) {
   set_test_result(s_res, 0, "generate_nrows", RC_dt_nrows(s_dt) == 2);
   set_test_result(s_res, 1, "generate_ncols", Rf_length(s_dt) == ss.n_params);
 
-  // Test dt_set_na and dt_is_na
-  dt_set_na(s_dt, 0, 0); // ParamDbl
-  dt_set_na(s_dt, 0, 1); // ParamInt
-  dt_set_na(s_dt, 0, 2); // ParamFct
-  dt_set_na(s_dt, 0, 3); // ParamLgl
-  set_test_result(s_res, 2, "is_na_dbl", dt_is_na(s_dt, 0, 0) == 1);
-  set_test_result(s_res, 3, "is_na_int", dt_is_na(s_dt, 0, 1) == 1);
-  set_test_result(s_res, 4, "is_na_fct", dt_is_na(s_dt, 0, 2) == 1);
-  set_test_result(s_res, 5, "is_na_lgl", dt_is_na(s_dt, 0, 3) == 1);
-
-
-  // Test dt_set_random
-  dt_set_random(s_dt, 0, 0, &ss);
-  dt_set_random(s_dt, 0, 1, &ss);
-  dt_set_random(s_dt, 0, 2, &ss);
-  dt_set_random(s_dt, 0, 3, &ss);
-  set_test_result(s_res, 6, "set_random_dbl", dt_is_na(s_dt, 0, 0) == 0);
-  set_test_result(s_res, 7, "set_random_int", dt_is_na(s_dt, 0, 1) == 0);
-  set_test_result(s_res, 8, "set_random_fct", dt_is_na(s_dt, 0, 2) == 0);
-  set_test_result(s_res, 9, "set_random_lgl", dt_is_na(s_dt, 0, 3) == 0);
-
-  // Test dt_mutate_element
+  // Test cfg_set_na and cfg_is_na
+  Configs cfg;
+  cfg_alloc(&cfg, 2, &ss);
+  cfg_set_na(&cfg, 0, 0); // ParamDbl
+  cfg_set_na(&cfg, 0, 1); // ParamInt
+  cfg_set_na(&cfg, 0, 2); // ParamFct
+  cfg_set_na(&cfg, 0, 3); // ParamLgl
+  set_test_result(s_res, 2, "is_na_dbl", cfg_is_na(&cfg, 0, 0) == 1);
+  set_test_result(s_res, 3, "is_na_int", cfg_is_na(&cfg, 0, 1) == 1);
+  set_test_result(s_res, 4, "is_na_fct", cfg_is_na(&cfg, 0, 2) == 1);
+  set_test_result(s_res, 5, "is_na_lgl", cfg_is_na(&cfg, 0, 3) == 1);
+
+  // Test cfg_set_random
+  cfg_set_random(&cfg, 0, 0, &ss, NULL);
+  cfg_set_random(&cfg, 0, 1, &ss, NULL);
+  cfg_set_random(&cfg, 0, 2, &ss, NULL);
+  cfg_set_random(&cfg, 0, 3, &ss, NULL);
+  set_test_result(s_res, 6, "set_random_dbl", cfg_is_na(&cfg, 0, 0) == 0);
+  set_test_result(s_res, 7, "set_random_int", cfg_is_na(&cfg, 0, 1) == 0);
+  set_test_result(s_res, 8, "set_random_fct", cfg_is_na(&cfg, 0, 2) == 0);
+  set_test_result(s_res, 9, "set_random_lgl", cfg_is_na(&cfg, 0, 3) == 0);
+
+  // Test cfg_mutate_element
   // First set some known values
+  cfg.dbl[0][1] = 0.5;     // ParamDbl
+  cfg.ints[1][1] = 5;      // ParamInt
+  cfg.ints[2][1] = 1;      // ParamFct, level "b"
+  bit_set(cfg.lgl[3], 1, 1); // ParamLgl
+
+  // Test mutation
+  cfg_mutate_element(&cfg, 1, 0, &ss, &ctrl, NULL); // ParamDbl
+  cfg_mutate_element(&cfg, 1, 1, &ss, &ctrl, NULL); // ParamInt
+  cfg_mutate_element(&cfg, 1, 2, &ss, &ctrl, NULL); // ParamFct
+  cfg_mutate_element(&cfg, 1, 3, &ss, &ctrl, NULL); // ParamLgl
+
+  // write to the DT, so we also check the conversion
+  cfg_to_dt(&cfg, NULL, 2, s_dt, &ss);
   SEXP s_col0 = VECTOR_ELT(s_dt, 0); // ParamDbl
   SEXP s_col1 = VECTOR_ELT(s_dt, 1); // ParamInt
   SEXP s_col2 = VECTOR_ELT(s_dt, 2); // ParamFct
   SEXP s_col3 = VECTOR_ELT(s_dt, 3); // ParamLgl
 
-  REAL(s_col0)[1] = 0.5;
-  INTEGER(s_col1)[1] = 5;
-  SET_STRING_ELT(s_col2, 1, mkChar("b"));
-  LOGICAL(s_col3)[1] = 1;
-
-  // Test mutation
-  dt_mutate_element(s_dt, 1, 0, &ss, &ctrl); // ParamDbl
-  dt_mutate_element(s_dt, 1, 1, &ss, &ctrl); // ParamInt
-  dt_mutate_element(s_dt, 1, 2, &ss, &ctrl); // ParamFct
-  dt_mutate_element(s_dt, 1, 3, &ss, &ctrl); // ParamLgl
-
   // Check that values were changed but still within bounds
   double dbl_val = REAL(s_col0)[1];
   set_test_result(s_res, 10, "mutate_dbl_changed", dbl_val != 0.5);
@@ -201,7 +223,10 @@ SEXP c_test_is_condition_satisfied(SEXP s_dt_row, SEXP s_ss, SEXP s_cond_idx, SE
   extract_ss_info(s_ss, &ss);
   SEXP s_res = PROTECT(RC_named_list_create_emptynames(1));
   Cond *cond = &ss.conds[asInteger(s_cond_idx)];
-  int ok = is_condition_satisfied(s_dt_row, 0, cond, &ss);
+  Configs cfg;
+  cfg_alloc(&cfg, RC_dt_nrows(s_dt_row), &ss);
+  cfg_from_dt(s_dt_row, &cfg, &ss);
+  int ok = is_condition_satisfied(&cfg, 0, cond, &ss);
   set_test_result(s_res, 0, "cond_satisfied", ok == asInteger(s_expected_satisfied));
   UNPROTECT(1); // s_res,
   return s_res;
@@ -221,11 +246,16 @@ SEXP c_test_generate_neighs(SEXP s_ss, SEXP s_ctrl, SEXP s_pop_x) {
     ctrl.n_searches = n_searches;
     DEBUG_PRINT("n_searches: %d, n_neighs: %d\n", n_searches, ctrl.n_neighs);
 
+    Configs pop_x, neighs_x;
+    cfg_alloc(&pop_x, n_searches, &ss);
+    cfg_alloc(&neighs_x, n_searches * ctrl.n_neighs, &ss);
+    cfg_from_dt(s_pop_x, &pop_x, &ss);
     SEXP s_neighs_x = PROTECT(dt_generate(n_searches * ctrl.n_neighs, &ss));
 
     GetRNGstate();
-    generate_neighs(s_pop_x, s_neighs_x, &ss, &ctrl);
+    generate_neighs(&pop_x, &neighs_x, &ss, &ctrl, rng_key_from_r(), 0);
     PutRNGstate();
+    cfg_to_dt(&neighs_x, NULL, neighs_x.n_rows, s_neighs_x, &ss);
 
     UNPROTECT(1); // s_neighs_x and
     return s_neighs_x;
@@ -241,16 +271,24 @@ SEXP c_test_copy_best_neighs_to_pop(SEXP s_ss, SEXP s_ctrl, SEXP s_pop_x, SEXP s
     SEXP s_pop_y_copy = PROTECT(duplicate(s_pop_y));
     double *pop_y_copy = REAL(s_pop_y_copy);
     double *neighs_y = REAL(s_neighs_y);
-    int *stagnate_count = (int*) R_alloc(ctrl.n_searches, sizeof(int));
 
     // there might be some bogus setting in ctrl.n_searches, so we overwrite it
     ctrl.n_searches = RC_dt_nrows(s_pop_x);
+    int *stagnate_count = (int*) R_alloc(ctrl.n_searches, sizeof(int));
+    memset(stagnate_count, 0, ctrl.n_searches * sizeof(int));
+
+    Configs pop_x, neighs_x, global_best_x;
+    cfg_alloc(&pop_x, ctrl.n_searches, &ss);
+    cfg_alloc(&neighs_x, RC_dt_nrows(s_neighs_x), &ss);
+    cfg_alloc(&global_best_x, 1, &ss);
+    cfg_from_dt(s_pop_x, &pop_x, &ss);
+    cfg_from_dt(s_neighs_x, &neighs_x, &ss);
 
     // Prepare global best placeholders
     double global_best_y = R_PosInf;
-    SEXP s_global_best_x = PROTECT(RC_named_list_create(ss.n_params, ss.param_names));
 
-    copy_best_neighs_to_pop(s_neighs_x, neighs_y, s_pop_x_copy, pop_y_copy, stagnate_count, &global_best_y, s_global_best_x, &ss, &ctrl);
+    copy_best_neighs_to_pop(&neighs_x, neighs_y, &pop_x, pop_y_copy, stagnate_count, &global_best_y, &global_best_x, &ss, &ctrl);
+    cfg_to_dt(&pop_x, NULL, pop_x.n_rows, s_pop_x_copy, &ss);
 
     SEXP s_res = PROTECT(allocVector(VECSXP, 2));
     SET_VECTOR_ELT(s_res, 0, s_pop_x_copy);
@@ -261,7 +299,7 @@ SEXP c_test_copy_best_neighs_to_pop(SEXP s_ss, SEXP s_ctrl, SEXP s_pop_x, SEXP s
     SET_STRING_ELT(s_names, 1, mkChar("pop_y"));
     setAttrib(s_res, R_NamesSymbol, s_names);
 
-    UNPROTECT(5); // s_pop_x_copy, s_pop_y_copy, s_global_best_x, s_res, s_names and
+    UNPROTECT(4); // s_pop_x_copy, s_pop_y_copy, s_res, s_names
     return s_res;
 }
 
@@ -270,7 +308,10 @@ SEXP c_test_get_best_pop_element(SEXP s_ss, SEXP s_ctrl, SEXP s_pop_x, SEXP s_po
     Control ctrl; extract_ctrl_info(s_ctrl, &ctrl);
     // there might be some bogus setting in ctrl.n_searches, so we overwrite it
     ctrl.n_searches = RC_dt_nrows(s_pop_x);
-    SEXP s_res = PROTECT(get_best_pop_element(s_pop_x, REAL(s_pop_y), &ss, &ctrl));
+    Configs pop_x;
+    cfg_alloc(&pop_x, ctrl.n_searches, &ss);
+    cfg_from_dt(s_pop_x, &pop_x, &ss);
+    SEXP s_res = PROTECT(get_best_pop_element(&pop_x, REAL(s_pop_y), &ss, &ctrl));
     UNPROTECT(1); // s_res,
     return s_res;
 }
@@ -282,9 +323,30 @@ SEXP c_test_dt_repair_row(SEXP s_ss, SEXP s_dt) {
     reorder_conds_by_toposort(&ss);
     // We make a copy of the DT to avoid modifying the original R object
     SEXP s_dt_copy = PROTECT(duplicate(s_dt));
+    Configs cfg;
+    cfg_alloc(&cfg, RC_dt_nrows(s_dt), &ss);
+    cfg_from_dt(s_dt, &cfg, &ss);
     GetRNGstate();
-    dt_repair_row(s_dt_copy, 0, &ss);
+    cfg_repair_row(&cfg, 0, &ss, NULL);
     PutRNGstate();
+    cfg_to_dt(&cfg, NULL, cfg.n_rows, s_dt_copy, &ss);
+    UNPROTECT(1); // s_dt_copy,
+    return s_dt_copy;
+}
+
+SEXP c_test_repair_descendants(SEXP s_ss, SEXP s_dt, SEXP s_param_idx) {
+    SearchSpace ss;
+    extract_ss_info(s_ss, &ss);
+    toposort_params(&ss);
+    reorder_conds_by_toposort(&ss);
+    SEXP s_dt_copy = PROTECT(duplicate(s_dt));
+    Configs cfg;
+    cfg_alloc(&cfg, RC_dt_nrows(s_dt), &ss);
+    cfg_from_dt(s_dt, &cfg, &ss);
+    GetRNGstate();
+    cfg_repair_descendants(&cfg, 0, asInteger(s_param_idx), &ss, NULL);
+    PutRNGstate();
+    cfg_to_dt(&cfg, NULL, cfg.n_rows, s_dt_copy, &ss);
     UNPROTECT(1); // s_dt_copy,
     return s_dt_copy;
 }
@@ -306,9 +368,13 @@ SEXP c_test_restart_stagnated_searches(SEXP s_ss, SEXP s_ctrl, SEXP s_pop_x, SEX
     double *pop_y = REAL(s_pop_y_copy);
     int *stagnate_count = INTEGER(s_stagnate_count);
 
+    Configs pop_x;
+    cfg_alloc(&pop_x, ctrl.n_searches, &ss);
+    cfg_from_dt(s_pop_x, &pop_x, &ss);
     GetRNGstate();
-    restart_stagnated_searches(s_pop_x_copy, pop_y, stagnate_count, &ss, &ctrl);
+    restart_stagnated_searches(&pop_x, pop_y, stagnate_count, &ss, &ctrl, rng_key_from_r(), 0);
     PutRNGstate();
+    cfg_to_dt(&pop_x, NULL, pop_x.n_rows, s_pop_x_copy, &ss);
 
     // return s_pop_x_copy and s_pop_y_copy as list
     SEXP s_res = PROTECT(allocVector(VECSXP, 2));
@@ -323,10 +389,75 @@ SEXP c_test_dt_set_random_row(SEXP s_ss, SEXP s_dt) {
     SearchSpace ss;
     extract_ss_info(s_ss, &ss);
     // We make a copy of the DT to avoid modifying the original R object
+    // the DT holds invalid values which we cannot read, so we only write the random row into it
     SEXP s_dt_copy = PROTECT(duplicate(s_dt));
+    Configs cfg;
+    cfg_alloc(&cfg, 1, &ss);
     GetRNGstate();
-    dt_set_random_row(s_dt_copy, 0, &ss); // test on the first row
+    cfg_set_random_row(&cfg, 0, &ss, NULL);
     PutRNGstate();
+    cfg_to_dt(&cfg, NULL, 1, s_dt_copy, &ss); // test on the first row
     UNPROTECT(1); // s_dt_copy,
     return s_dt_copy;
 }
+
+SEXP c_test_cache(SEXP s_ss, SEXP s_dt) {
+  SEXP s_res = PROTECT(RC_named_list_create_emptynames(7));
+  SearchSpace ss;
+  extract_ss_info(s_ss, &ss);
+  Configs cfg;
+  cfg_alloc(&cfg, RC_dt_nrows(s_dt), &ss);
+  cfg_from_dt(s_dt, &cfg, &ss);
+
+  // rows 0 and 1 are equal, row 2 differs only in a NA, row 3 has -0.0 instead of 0.0
+  set_test_result(s_res, 0, "equal_rows", cfg_rows_equal(&cfg, 0, &cfg, 1, &ss));
+  set_test_result(s_res, 1, "equal_hash", cfg_hash_row(&cfg, 0, &ss) == cfg_hash_row(&cfg, 1, &ss));
+  set_test_result(s_res, 2, "na_differs", !cfg_rows_equal(&cfg, 0, &cfg, 2, &ss));
+  set_test_result(s_res, 3, "neg_zero_hash", cfg_hash_row(&cfg, 3, &ss) == cfg_hash_row(&cfg, 4, &ss));
+
+  // insert many rows, so the cache has to grow, then all of them must still be found
+  Cache cache;
+  cache_init(&cache, 1, 1, &ss);
+  int ok_insert = 1, ok_find = 1;
+  for (int k = 0; k < 200; k++) {
+    cfg.dbl[0][0] = k;
+    uint64_t hash = cfg_hash_row(&cfg, 0, &ss);
+    if (cache_find(&cache, &cfg, 0, hash, &ss) != -1) ok_insert = 0;
+    cache_insert(&cache, &cfg, 0, hash, k, &ss);
+  }
+  for (int k = 0; k < 200; k++) {
+    cfg.dbl[0][0] = k;
+    int idx = cache_find(&cache, &cfg, 0, cfg_hash_row(&cfg, 0, &ss), &ss);
+    if (idx == -1 || cache.y[idx] != k) ok_find = 0;
+  }
+  set_test_result(s_res, 4, "insert_new", ok_insert);
+  set_test_result(s_res, 5, "find_after_grow", ok_find);
+  set_test_result(s_res, 6, "n_entries", cache.n == 200);
+  UNPROTECT(1); // s_res
+  return s_res;
+}
+
+// native test objective: sum of squares of all active numeric params, plus level index for factors,
+// plus the bit for logicals, inactive params contribute 0
+int test_native_objective_fn(const Configs *x, double *y, void *data) {
+  (void) data;
+  for (int i = 0; i < x->n_rows; i++) {
+    double value = 0.0;
+    for (int j = 0; j < x->n_params; j++) {
+      if (bbotk_bit_get(x->na[j], i)) continue;
+      if (x->dbl[j] != NULL) {
+        value += x->dbl[j][i] * x->dbl[j][i];
+      } else if (x->ints[j] != NULL) {
+        value += x->ints[j][i];
+      } else {
+        value += bbotk_bit_get(x->lgl[j], i);
+      }
+    }
+    y[i] = value;
+  }
+  return 0;
+}
+
+SEXP c_test_native_objective(void) {
+  return bbotk_native_objective_create(test_native_objective_fn, NULL);
+}
@@ -12,5 +12,8 @@ SEXP c_test_copy_best_neighs_to_pop(SEXP s_ss, SEXP s_ctrl, SEXP s_pop_x, SEXP s
   SEXP s_neighs_x, SEXP s_neighs_y);
 SEXP c_test_get_best_pop_element(SEXP s_ss, SEXP s_ctrl, SEXP s_pop_x, SEXP s_pop_y);
 SEXP c_test_dt_repair_row(SEXP s_ss, SEXP s_dt);
+SEXP c_test_repair_descendants(SEXP s_ss, SEXP s_dt, SEXP s_param_idx);
 SEXP c_test_restart_stagnated_searches(SEXP s_ss, SEXP s_ctrl, SEXP s_pop_x, SEXP s_pop_y, SEXP s_stagnate_count);
 SEXP c_test_dt_set_random_row(SEXP s_ss, SEXP s_dt);
+SEXP c_test_cache(SEXP s_ss, SEXP s_dt);
+SEXP c_test_native_objective(void);